@@ -0,0 +1,244 @@
+//===-- BinaryELF.cpp - Raw binary input to relocatable ELF ---------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements -I binary: wrapping raw data in a relocatable ELF
+// object so it can be linked in directly.  The object has the layout
+//
+//   ELF header, .data, .symtab, .strtab, .shstrtab, section header table
+//
+// and, with no contents of its own, a .note.GNU-stack section, without which
+// linkers assume the object needs an executable stack.  It defines the same
+// symbols as GNU objcopy: _binary_<name>_start and _binary_<name>_end around
+// the data, and the absolute _binary_<name>_size, where <name> is the input
+// file name with every character that is not a letter or digit replaced by
+// an underscore.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm-objcopy.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Support/ELF.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cctype>
+#include <cstring>
+
+using namespace llvm;
+using namespace object;
+
+namespace {
+
+struct ELFTarget {
+    Triple::ArchType Arch;
+    unsigned         Machine;
+    bool             Is64Bits;
+    bool             IsLittleEndian;
+    unsigned         Flags;
+};
+
+const ELFTarget Targets[] = {
+    { Triple::x86,      ELF::EM_386,     false, true,  0 },
+    { Triple::x86_64,   ELF::EM_X86_64,  true,  true,  0 },
+    { Triple::arm,      ELF::EM_ARM,     false, true,  0x05000000 },    // EF_ARM_EABI_VER5
+    { Triple::thumb,    ELF::EM_ARM,     false, true,  0x05000000 },
+    { Triple::aarch64,  ELF::EM_AARCH64, true,  true,  0 },
+    { Triple::mips,     ELF::EM_MIPS,    false, false, 0 },
+    { Triple::mipsel,   ELF::EM_MIPS,    false, true,  0 },
+    { Triple::mips64,   ELF::EM_MIPS,    true,  false, 0 },
+    { Triple::mips64el, ELF::EM_MIPS,    true,  true,  0 },
+    { Triple::ppc,      ELF::EM_PPC,     false, false, 0 },
+    { Triple::ppc64,    ELF::EM_PPC64,   true,  false, 0 },
+    { Triple::sparc,    ELF::EM_SPARC,   false, false, 0 },
+    { Triple::sparcv9,  ELF::EM_SPARCV9, true,  false, 0 },
+    { Triple::systemz,  ELF::EM_S390,    true,  false, 0 },
+};
+
+// Section numbers in the output.
+enum {
+    DataIndex = 1,
+    GNUStackIndex,
+    SymTabIndex,
+    StrTabIndex,
+    ShStrTabIndex,
+    NumSections
+};
+
+template <class ELFT>
+class BinaryELFWriter {
+    typedef typename ELFFile<ELFT>::Elf_Ehdr Elf_Ehdr;
+    typedef typename ELFFile<ELFT>::Elf_Shdr Elf_Shdr;
+    typedef typename ELFFile<ELFT>::Elf_Sym  Elf_Sym;
+
+public:
+    BinaryELFWriter(const ELFTarget &Target, StringRef Data, StringRef SymbolPrefix)
+        : mTarget(Target)
+        , mData(Data)
+        , mPrefix(SymbolPrefix)
+    {
+    }
+
+    void write(raw_ostream &OS);
+
+private:
+    void addSymbol(StringRef Name, uint64_t Value, unsigned Binding, unsigned Type, unsigned Section);
+    void setSection(unsigned Index, StringRef Name, unsigned Type, uint64_t Flags,
+                    uint64_t Offset, uint64_t Size, uint64_t Align);
+
+    const ELFTarget        &mTarget;
+    StringRef               mData;
+    std::string             mPrefix;
+    std::vector<Elf_Sym>    mSymbols;
+    std::string             mStrTab;
+    std::string             mShStrTab;
+    Elf_Shdr                mShdrs[NumSections];
+};
+
+template <class ELFT>
+void BinaryELFWriter<ELFT>::addSymbol(StringRef Name, uint64_t Value, unsigned Binding, unsigned Type,
+                                      unsigned Section) {
+    Elf_Sym Sym;
+    memset(&Sym, 0, sizeof(Sym));
+    if (!Name.empty()) {
+        Sym.st_name = mStrTab.size();
+        mStrTab += Name;
+        mStrTab += '\0';
+    }
+    Sym.st_value = Value;
+    Sym.st_info  = (Binding << 4) | Type;
+    Sym.st_shndx = Section;
+    mSymbols.push_back(Sym);
+}
+
+template <class ELFT>
+void BinaryELFWriter<ELFT>::setSection(unsigned Index, StringRef Name, unsigned Type, uint64_t Flags,
+                                       uint64_t Offset, uint64_t Size, uint64_t Align) {
+    Elf_Shdr &Shdr = mShdrs[Index];
+    Shdr.sh_name      = mShStrTab.size();
+    Shdr.sh_type      = Type;
+    Shdr.sh_flags     = Flags;
+    Shdr.sh_offset    = Offset;
+    Shdr.sh_size      = Size;
+    Shdr.sh_addralign = Align;
+    mShStrTab += Name;
+    mShStrTab += '\0';
+}
+
+template <class ELFT>
+void BinaryELFWriter<ELFT>::write(raw_ostream &OS) {
+    mStrTab   = std::string(1, '\0');
+    mShStrTab = std::string(1, '\0');
+    memset(mShdrs, 0, sizeof(mShdrs));
+
+    addSymbol("", 0, ELF::STB_LOCAL, ELF::STT_NOTYPE, ELF::SHN_UNDEF);
+    addSymbol("", 0, ELF::STB_LOCAL, ELF::STT_SECTION, DataIndex);
+    unsigned FirstGlobal = mSymbols.size();
+    addSymbol(mPrefix + "_start", 0,             ELF::STB_GLOBAL, ELF::STT_NOTYPE, DataIndex);
+    addSymbol(mPrefix + "_end",   mData.size(),  ELF::STB_GLOBAL, ELF::STT_NOTYPE, DataIndex);
+    addSymbol(mPrefix + "_size",  mData.size(),  ELF::STB_GLOBAL, ELF::STT_NOTYPE, ELF::SHN_ABS);
+
+    uint64_t WordAlign  = ELFT::Is64Bits ? 8 : 4;
+    uint64_t DataOffset = sizeof(Elf_Ehdr);
+    uint64_t SymOffset  = RoundUpToAlignment(DataOffset + mData.size(), WordAlign);
+    uint64_t SymSize    = mSymbols.size() * sizeof(Elf_Sym);
+    uint64_t StrOffset  = SymOffset + SymSize;
+
+    setSection(DataIndex, ".data", ELF::SHT_PROGBITS, ELF::SHF_ALLOC | ELF::SHF_WRITE,
+               DataOffset, mData.size(), 1);
+    setSection(GNUStackIndex, ".note.GNU-stack", ELF::SHT_PROGBITS, 0, SymOffset, 0, 1);
+    setSection(SymTabIndex, ".symtab", ELF::SHT_SYMTAB, 0, SymOffset, SymSize, WordAlign);
+    mShdrs[SymTabIndex].sh_link    = StrTabIndex;
+    mShdrs[SymTabIndex].sh_info    = FirstGlobal;
+    mShdrs[SymTabIndex].sh_entsize = sizeof(Elf_Sym);
+    setSection(StrTabIndex, ".strtab", ELF::SHT_STRTAB, 0, StrOffset, mStrTab.size(), 1);
+
+    uint64_t ShStrOffset = StrOffset + mStrTab.size();
+    setSection(ShStrTabIndex, ".shstrtab", ELF::SHT_STRTAB, 0, ShStrOffset, 0, 1);
+    mShdrs[ShStrTabIndex].sh_size = mShStrTab.size();
+
+    uint64_t ShOffset = RoundUpToAlignment(ShStrOffset + mShStrTab.size(), WordAlign);
+
+    Elf_Ehdr Header;
+    memset(&Header, 0, sizeof(Header));
+    Header.e_ident[ELF::EI_MAG0]    = ELF::ElfMagic[0];
+    Header.e_ident[ELF::EI_MAG1]    = ELF::ElfMagic[1];
+    Header.e_ident[ELF::EI_MAG2]    = ELF::ElfMagic[2];
+    Header.e_ident[ELF::EI_MAG3]    = ELF::ElfMagic[3];
+    Header.e_ident[ELF::EI_CLASS]   = ELFT::Is64Bits ? ELF::ELFCLASS64 : ELF::ELFCLASS32;
+    Header.e_ident[ELF::EI_DATA]    = mTarget.IsLittleEndian ? ELF::ELFDATA2LSB : ELF::ELFDATA2MSB;
+    Header.e_ident[ELF::EI_VERSION] = ELF::EV_CURRENT;
+    Header.e_type      = ELF::ET_REL;
+    Header.e_machine   = mTarget.Machine;
+    Header.e_version   = ELF::EV_CURRENT;
+    Header.e_shoff     = ShOffset;
+    Header.e_flags     = mTarget.Flags;
+    Header.e_ehsize    = sizeof(Elf_Ehdr);
+    Header.e_shentsize = sizeof(Elf_Shdr);
+    Header.e_shnum     = NumSections;
+    Header.e_shstrndx  = ShStrTabIndex;
+
+    OS.write(reinterpret_cast<const char *>(&Header), sizeof(Header));
+    OS << mData;
+    writeZeros(OS, SymOffset - (DataOffset + mData.size()));
+    OS.write(reinterpret_cast<const char *>(&mSymbols[0]), SymSize);
+    OS << mStrTab << mShStrTab;
+    writeZeros(OS, ShOffset - (ShStrOffset + mShStrTab.size()));
+    OS.write(reinterpret_cast<const char *>(mShdrs), sizeof(mShdrs));
+}
+
+template <class ELFT>
+void writeBinaryELFImpl(const ELFTarget &Target, StringRef Data, StringRef SymbolPrefix, raw_ostream &OS) {
+    BinaryELFWriter<ELFT> Writer(Target, Data, SymbolPrefix);
+    Writer.write(OS);
+}
+
+} // end anonymous namespace
+
+bool llvm::writeBinaryELF(StringRef Data, StringRef InputName, StringRef Arch, StringRef OutputFilename) {
+    Triple::ArchType ArchType = Triple(Arch).getArch();
+    const ELFTarget *Target = NULL;
+    for (size_t i = 0, e = array_lengthof(Targets); i != e; ++i) {
+        if (Targets[i].Arch == ArchType) Target = &Targets[i];
+    }
+    if (Target == NULL) {
+        errs() << "binary input: unsupported architecture '" << Arch << "'\n";
+        return false;
+    }
+
+    std::string SymbolPrefix = "_binary_";
+    for (size_t i = 0, e = InputName.size(); i != e; ++i) {
+        SymbolPrefix += isalnum(static_cast<unsigned char>(InputName[i])) ? InputName[i] : '_';
+    }
+
+    std::string ErrorInfo;
+    tool_output_file Out(OutputFilename.data(), ErrorInfo, sys::fs::F_Binary);
+    if (!ErrorInfo.empty()) {
+        errs() << ErrorInfo << '\n';
+        return false;
+    }
+
+    if (Target->Is64Bits) {
+        if (Target->IsLittleEndian) {
+            writeBinaryELFImpl<ELFType<support::little, 8, true> >(*Target, Data, SymbolPrefix, Out.os());
+        } else {
+            writeBinaryELFImpl<ELFType<support::big, 8, true> >(*Target, Data, SymbolPrefix, Out.os());
+        }
+    } else {
+        if (Target->IsLittleEndian) {
+            writeBinaryELFImpl<ELFType<support::little, 4, false> >(*Target, Data, SymbolPrefix, Out.os());
+        } else {
+            writeBinaryELFImpl<ELFType<support::big, 4, false> >(*Target, Data, SymbolPrefix, Out.os());
+        }
+    }
+
+    Out.keep();
+    return true;
+}
@@ -0,0 +1,125 @@
+//===-- Compress.cpp - LZ4 block compression -------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements a compressor for the LZ4 block format, used for the
+// blocks of -O binary_lz4 output.  Each block is a series of sequences:
+//
+//   <token> [literal length] <literals> <offset> [match length]
+//
+// The high nibble of the token is the number of literals and the low nibble
+// the match length minus four; a nibble of 15 is continued in the following
+// bytes, each adding up to 255.  The offset is two bytes, little-endian.  The
+// last sequence has literals only.  Any LZ4 block decoder can expand the
+// output; nothing here depends on the LZ4 library.
+//
+// The compressor is a greedy single-probe hash matcher, which is fast and
+// does well on what flat images mostly contain: padding and repeated data.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm-objcopy.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace llvm;
+
+namespace {
+
+const size_t   MinMatch     = 4;
+const size_t   LastLiterals = 5;        // The last five bytes are always literals.
+const size_t   MatchMargin  = 12;       // No match starts closer than this to the end.
+const size_t   MaxOffset    = 65535;
+const unsigned HashBits     = 14;
+const uint32_t NoPosition   = ~uint32_t(0);
+
+uint32_t Read32(const char *P) {
+    uint32_t Value;
+    memcpy(&Value, P, sizeof(Value));
+    return Value;
+}
+
+void Write32(char *P, uint32_t Value) {
+    memcpy(P, &Value, sizeof(Value));
+}
+
+unsigned Hash(uint32_t Value) {
+    return (Value * 2654435761U) >> (32 - HashBits);
+}
+
+void WriteLength(std::string &Output, size_t Length) {
+    for (; Length >= 255; Length -= 255) {
+        Output += char(255);
+    }
+    Output += char(Length);
+}
+
+// Append a sequence of NumLiterals literals followed by a match of
+// MatchLength bytes at distance Offset.  A MatchLength of zero ends the block.
+void WriteSequence(std::string &Output, const char *Literals, size_t NumLiterals,
+                   size_t Offset, size_t MatchLength) {
+    unsigned Token = std::min<size_t>(NumLiterals, 15) << 4;
+    if (MatchLength != 0) Token |= std::min<size_t>(MatchLength - MinMatch, 15);
+
+    Output += char(Token);
+    if (NumLiterals >= 15) WriteLength(Output, NumLiterals - 15);
+    Output.append(Literals, NumLiterals);
+
+    if (MatchLength == 0) return;
+    Output += char(Offset & 0xff);
+    Output += char(Offset >> 8);
+    if (MatchLength - MinMatch >= 15) WriteLength(Output, MatchLength - MinMatch - 15);
+}
+
+} // end anonymous namespace
+
+void llvm::compressLZ4Block(StringRef Input, std::string &Output, std::string &Scratch) {
+    const char *Data   = Input.data();
+    size_t      Size   = Input.size();
+    size_t      Anchor = 0;
+
+    if (Size > MatchMargin) {
+        // The hash table, a uint32_t position per slot, all NoPosition.
+        Scratch.assign(sizeof(uint32_t) << HashBits, char(0xff));
+        char   *Table      = &Scratch[0];
+        size_t  MatchLimit = Size - LastLiterals;
+        size_t  Misses     = 0;
+
+        for (size_t Pos = 0; Pos + MatchMargin <= Size; ) {
+            uint32_t Sequence  = Read32(Data + Pos);
+            unsigned Slot      = Hash(Sequence);
+            uint32_t Candidate = Read32(Table + Slot * sizeof(uint32_t));
+            Write32(Table + Slot * sizeof(uint32_t), Pos);
+
+            if (   Candidate == NoPosition
+                || Pos - Candidate > MaxOffset
+                || Read32(Data + Candidate) != Sequence) {
+                // Step faster through data that does not compress.
+                Pos += 1 + (Misses++ >> 6);
+                continue;
+            }
+            Misses = 0;
+
+            size_t Start = Pos;
+            while (Start > Anchor && Candidate > 0 && Data[Start - 1] == Data[Candidate - 1]) {
+                --Start;
+                --Candidate;
+            }
+            size_t Length = MinMatch + (Pos - Start);
+            while (Start + Length < MatchLimit && Data[Start + Length] == Data[Candidate + Length]) {
+                ++Length;
+            }
+
+            WriteSequence(Output, Data + Anchor, Start - Anchor, Start - Candidate, Length);
+            Pos    = Start + Length;
+            Anchor = Pos;
+        }
+    }
+
+    WriteSequence(Output, Data + Anchor, Size - Anchor, 0, 0);
+}
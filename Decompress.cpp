@@ -0,0 +1,144 @@
+//===-- Decompress.cpp - Compressed ELF sections --------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the lookup and inflation of compressed sections, so
+// that their data rather than the compressed stream ends up in the output.
+// Two encodings are recognised:
+//
+//   - Sections with SHF_COMPRESSED set, which start with an Elf32_Chdr or
+//     Elf64_Chdr giving the compression type and uncompressed size.
+//   - GNU-style .zdebug sections, which start with "ZLIB" followed by the
+//     uncompressed size as a 64-bit big-endian number.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm-objcopy.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Support/Compression.h"
+#include "llvm/Support/ELF.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+using namespace object;
+
+namespace {
+
+// Not yet in Support/ELF.h.
+const uint64_t SHF_COMPRESSED   = 0x800;
+const unsigned ELFCOMPRESS_ZLIB = 1;
+
+template <class ELFT>
+void findCompressedSections(const ELFObjectFile<ELFT> *Obj, SectionDecompressor::SectionMap &Sections) {
+    typedef typename ELFFile<ELFT>::Elf_Ehdr Elf_Ehdr;
+    typedef typename ELFFile<ELFT>::Elf_Shdr Elf_Shdr;
+    typedef support::detail::packed_endian_specific_integral<
+        uint32_t, ELFT::TargetEndianness, support::unaligned> Elf_Word;
+    typedef support::detail::packed_endian_specific_integral<
+        uint64_t, ELFT::TargetEndianness, support::unaligned> Elf_Xword;
+
+    struct Elf32_Chdr { Elf_Word ch_type; Elf_Word ch_size; Elf_Word  ch_addralign; };
+    struct Elf64_Chdr { Elf_Word ch_type; Elf_Word ch_reserved; Elf_Xword ch_size; Elf_Xword ch_addralign; };
+
+    StringRef Data = Obj->getData();
+    if (Data.size() < sizeof(Elf_Ehdr)) return;
+    const Elf_Ehdr *Header = reinterpret_cast<const Elf_Ehdr *>(Data.data());
+
+    uint64_t ShOff = Header->e_shoff;
+    uint64_t ShNum = Header->e_shnum;
+    if (   ShOff == 0
+        || Header->e_shentsize != sizeof(Elf_Shdr)
+        || ShOff > Data.size()
+        || Data.size() - ShOff < sizeof(Elf_Shdr)) {
+        return;
+    }
+    const Elf_Shdr *Shdrs = reinterpret_cast<const Elf_Shdr *>(Data.data() + ShOff);
+
+    // Past SHN_LORESERVE sections, the count is kept in section 0.
+    if (ShNum == 0) ShNum = Shdrs[0].sh_size;
+    if ((Data.size() - ShOff) / sizeof(Elf_Shdr) < ShNum) return;
+
+    for (uint64_t i = 1; i < ShNum; ++i) {
+        const Elf_Shdr &Shdr = Shdrs[i];
+        if (   !(Shdr.sh_flags & SHF_COMPRESSED)
+            || Shdr.sh_type == ELF::SHT_NOBITS
+            || Shdr.sh_offset + Shdr.sh_size > Data.size()) {
+            continue;
+        }
+
+        StringRef Contents = Data.substr(Shdr.sh_offset, Shdr.sh_size);
+        SectionDecompressor::Compressed Section;
+        if (ELFT::Is64Bits) {
+            if (Contents.size() < sizeof(Elf64_Chdr)) continue;
+            const Elf64_Chdr *Chdr = reinterpret_cast<const Elf64_Chdr *>(Contents.data());
+            Section.Type   = Chdr->ch_type;
+            Section.Size   = Chdr->ch_size;
+            Section.Stream = Contents.drop_front(sizeof(Elf64_Chdr));
+        } else {
+            if (Contents.size() < sizeof(Elf32_Chdr)) continue;
+            const Elf32_Chdr *Chdr = reinterpret_cast<const Elf32_Chdr *>(Contents.data());
+            Section.Type   = Chdr->ch_type;
+            Section.Size   = Chdr->ch_size;
+            Section.Stream = Contents.drop_front(sizeof(Elf32_Chdr));
+        }
+        Sections[Contents.data()] = Section;
+    }
+}
+
+} // end anonymous namespace
+
+SectionDecompressor::SectionDecompressor(ObjectFile *o) {
+    if (const ELF32LEObjectFile *ELFObj = dyn_cast<ELF32LEObjectFile>(o)) {
+        findCompressedSections(ELFObj, mSections);
+    } else if (const ELF32BEObjectFile *ELFObj = dyn_cast<ELF32BEObjectFile>(o)) {
+        findCompressedSections(ELFObj, mSections);
+    } else if (const ELF64LEObjectFile *ELFObj = dyn_cast<ELF64LEObjectFile>(o)) {
+        findCompressedSections(ELFObj, mSections);
+    } else if (const ELF64BEObjectFile *ELFObj = dyn_cast<ELF64BEObjectFile>(o)) {
+        findCompressedSections(ELFObj, mSections);
+    }
+}
+
+bool SectionDecompressor::isCompressed(StringRef Name, StringRef Contents, Compressed &Section) const {
+    SectionMap::const_iterator It = mSections.find(Contents.data());
+    if (It != mSections.end() && Contents.size() != 0) {
+        Section = It->second;
+        return true;
+    }
+
+    if (Name.startswith(".zdebug") && Contents.size() >= 12 && Contents.startswith("ZLIB")) {
+        uint64_t Size = 0;
+        for (unsigned i = 4; i != 12; ++i) {
+            Size = (Size << 8) | static_cast<unsigned char>(Contents[i]);
+        }
+        Section.Type   = ELFCOMPRESS_ZLIB;
+        Section.Size   = Size;
+        Section.Stream = Contents.drop_front(12);
+        return true;
+    }
+
+    return false;
+}
+
+bool SectionDecompressor::decompress(StringRef Name, const Compressed &Section, OwningPtr<MemoryBuffer> &Result) {
+    if (Section.Type != ELFCOMPRESS_ZLIB) {
+        errs() << "section " << Name << ": unsupported compression type " << Section.Type << "\n";
+        return false;
+    }
+    if (!zlib::isAvailable()) {
+        errs() << "section " << Name << ": compressed, but zlib support is not available\n";
+        return false;
+    }
+    if (   zlib::uncompress(Section.Stream, Result, Section.Size) != zlib::StatusOK
+        || Result->getBufferSize() != Section.Size) {
+        errs() << "section " << Name << ": corrupt compressed data\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,246 @@
+//===-- Delta.cpp - Binary delta between two flat images ------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the delta written by --delta-from: a compact encoding
+// of a new flat image in terms of an old one, for over-the-air updates.
+//
+// A delta starts with the magic "LOCD" followed by the sizes of the old and
+// the new image as ULEB128 numbers.  After that come operations, each a
+// one-byte opcode followed by ULEB128 operands:
+//
+//   0x01 <offset> <length>   Copy <length> bytes from the old image.
+//   0x02 <length> <bytes>    Append <length> literal bytes.
+//
+// Applying the operations in order reproduces the new image.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm-objcopy.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstring>
+
+using namespace llvm;
+
+namespace {
+
+enum DeltaOpcode {
+    DeltaCopy    = 0x01,
+    DeltaLiteral = 0x02
+};
+
+// The old image is indexed in blocks of this size, which is also the
+// shortest match that is looked for.
+const size_t BlockSize = 32;
+
+// rsync-style rolling checksum over a window of BlockSize bytes.
+class RollingHash {
+public:
+    void init(const unsigned char *Data) {
+        mA = 0;
+        mB = 0;
+        for (size_t i = 0; i != BlockSize; ++i) {
+            mA += Data[i];
+            mB += (BlockSize - i) * Data[i];
+        }
+    }
+
+    // Slide the window one byte: Out leaves it and In enters.
+    void roll(unsigned char Out, unsigned char In) {
+        mA += In - Out;
+        mB += mA - BlockSize * Out;
+    }
+
+    // Kept below 0x7fffffff so the value never collides with DenseMap's
+    // reserved keys.
+    uint32_t value() const { return ((mA & 0xffff) | (mB << 16)) & 0x7fffffff; }
+
+private:
+    uint32_t mA;
+    uint32_t mB;
+};
+
+class DeltaEncoder {
+public:
+    DeltaEncoder(StringRef Old, StringRef New, raw_ostream &OS)
+        : mOld(Old)
+        , mNew(New)
+        , mOS(OS)
+        , mLiteralStart(0)
+        , mCopies(0)
+        , mCopiedBytes(0)
+        , mLiterals(0)
+        , mLiteralBytes(0)
+    {
+    }
+
+    void run() {
+        const unsigned char *Old = reinterpret_cast<const unsigned char *>(mOld.data());
+        const unsigned char *New = reinterpret_cast<const unsigned char *>(mNew.data());
+
+        mOS << "LOCD";
+        encodeULEB128(mOld.size(), mOS);
+        encodeULEB128(mNew.size(), mOS);
+
+        // Index the old image.  Only the first occurrence of a block is kept.
+        RollingHash Hash;
+        for (uint64_t Offset = 0; Offset + BlockSize <= mOld.size(); Offset += BlockSize) {
+            Hash.init(Old + Offset);
+            mIndex.insert(std::make_pair(Hash.value(), Offset));
+        }
+
+        uint64_t Pos          = 0;
+        int64_t  Displacement = 0;
+        bool     HaveHash     = false;
+        while (Pos + BlockSize <= mNew.size()) {
+            // Code and data usually only shift between versions, so first try
+            // to continue at the displacement of the previous copy.
+            int64_t  Candidate = int64_t(Pos) + Displacement;
+            uint64_t OldPos    = UINT64_MAX;
+            if (   Candidate >= 0
+                && uint64_t(Candidate) + BlockSize <= mOld.size()
+                && memcmp(Old + Candidate, New + Pos, BlockSize) == 0) {
+                OldPos = Candidate;
+            } else {
+                if (!HaveHash) {
+                    Hash.init(New + Pos);
+                    HaveHash = true;
+                }
+                DenseMap<uint32_t, uint64_t>::iterator It = mIndex.find(Hash.value());
+                if (It != mIndex.end() && memcmp(Old + It->second, New + Pos, BlockSize) == 0) {
+                    OldPos = It->second;
+                }
+            }
+
+            if (OldPos == UINT64_MAX) {
+                if (Pos + BlockSize < mNew.size()) Hash.roll(New[Pos], New[Pos + BlockSize]);
+                ++Pos;
+                continue;
+            }
+
+            // Grow the match backwards into the pending literal, then forwards.
+            while (Pos > mLiteralStart && OldPos > 0 && Old[OldPos - 1] == New[Pos - 1]) {
+                --Pos;
+                --OldPos;
+            }
+            uint64_t Length = BlockSize;
+            while (   OldPos + Length < mOld.size() && Pos + Length < mNew.size()
+                   && Old[OldPos + Length] == New[Pos + Length]) {
+                ++Length;
+            }
+
+            emitLiteral(Pos);
+            emitCopy(OldPos, Length);
+
+            Displacement  = int64_t(OldPos) - int64_t(Pos);
+            Pos          += Length;
+            mLiteralStart = Pos;
+            HaveHash      = false;
+        }
+        emitLiteral(mNew.size());
+    }
+
+    void printStatistics(raw_ostream &OS) const {
+        OS << "copied " << mCopiedBytes << " bytes in " << mCopies << " operations\n";
+        OS << "inserted " << mLiteralBytes << " bytes in " << mLiterals << " operations\n";
+    }
+
+private:
+    void emitCopy(uint64_t Offset, uint64_t Length) {
+        mOS << char(DeltaCopy);
+        encodeULEB128(Offset, mOS);
+        encodeULEB128(Length, mOS);
+        ++mCopies;
+        mCopiedBytes += Length;
+    }
+
+    // Emit the bytes of the new image from the end of the last operation up
+    // to End as a literal.
+    void emitLiteral(uint64_t End) {
+        if (End <= mLiteralStart) return;
+
+        uint64_t Length = End - mLiteralStart;
+        mOS << char(DeltaLiteral);
+        encodeULEB128(Length, mOS);
+        mOS.write(mNew.data() + mLiteralStart, Length);
+        ++mLiterals;
+        mLiteralBytes += Length;
+        mLiteralStart  = End;
+    }
+
+    StringRef                       mOld;
+    StringRef                       mNew;
+    raw_ostream                    &mOS;
+    DenseMap<uint32_t, uint64_t>    mIndex;
+    uint64_t                        mLiteralStart;
+
+    uint64_t                        mCopies;
+    uint64_t                        mCopiedBytes;
+    uint64_t                        mLiterals;
+    uint64_t                        mLiteralBytes;
+};
+
+} // end anonymous namespace
+
+// Standard CRC-32 (as used by zlib), so images can be checked on the device
+// before and after applying the delta.
+static uint32_t Crc32(StringRef Data) {
+    static uint32_t Table[256];
+    if (Table[1] == 0) {
+        for (uint32_t i = 0; i != 256; ++i) {
+            uint32_t C = i;
+            for (unsigned k = 0; k != 8; ++k) {
+                C = (C & 1) ? 0xedb88320 ^ (C >> 1) : C >> 1;
+            }
+            Table[i] = C;
+        }
+    }
+
+    uint32_t Crc = 0xffffffff;
+    for (size_t i = 0, e = Data.size(); i != e; ++i) {
+        Crc = Table[(Crc ^ (unsigned char)Data[i]) & 0xff] ^ (Crc >> 8);
+    }
+    return Crc ^ 0xffffffff;
+}
+
+bool llvm::writeDelta(StringRef Old, StringRef New, StringRef OutputFilename,
+                      StringRef ManifestFilename) {
+    std::string ErrorInfo;
+
+    tool_output_file Out(OutputFilename.data(), ErrorInfo, sys::fs::F_Binary);
+    if (!ErrorInfo.empty()) {
+        errs() << ErrorInfo << '\n';
+        return false;
+    }
+
+    DeltaEncoder Encoder(Old, New, Out.os());
+    Encoder.run();
+
+    if (!ManifestFilename.empty()) {
+        tool_output_file Manifest(ManifestFilename.data(), ErrorInfo, sys::fs::F_None);
+        if (!ErrorInfo.empty()) {
+            errs() << ErrorInfo << '\n';
+            return false;
+        }
+
+        Manifest.os() << "old-size " << Old.size() << "\n"
+                      << "old-crc32 " << format("0x%08" PRIx32, Crc32(Old)) << "\n"
+                      << "new-size " << New.size() << "\n"
+                      << "new-crc32 " << format("0x%08" PRIx32, Crc32(New)) << "\n"
+                      << "delta-size " << Out.os().tell() << "\n";
+        Encoder.printStatistics(Manifest.os());
+        Manifest.keep();
+    }
+
+    Out.keep();
+    return true;
+}
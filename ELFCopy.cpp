@@ -0,0 +1,577 @@
+//===-- ELFCopy.cpp - ELF to ELF copying ----------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements -O elf: copying an ELF file while leaving out some of
+// its non-allocated sections, typically debug information and notes.
+//
+// Everything the loader sees (the ELF and program headers, and all allocated
+// sections and segments) keeps its file offset and is copied as one block
+// straight from the mapped input.  The retained non-allocated sections are
+// laid out again after it, followed by a new section header table.  Files
+// without program headers, such as relocatable objects, have nothing the
+// loader depends on, so all of their sections are laid out again.
+//
+// When the output is the input file itself and the only change is new
+// contents for sections that fit in their existing file extent, those bytes
+// and section headers are patched in place instead.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm-objcopy.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Config/config.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Support/ELF.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/system_error.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#ifdef LLVM_ON_UNIX
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace llvm;
+using namespace object;
+
+namespace {
+
+#ifdef LLVM_ON_UNIX
+bool WriteAt(int FD, const char *Ptr, size_t Size, uint64_t Offset) {
+    while (Size != 0) {
+        ssize_t N = ::pwrite(FD, Ptr, Size, Offset);
+        if (N < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        Ptr    += N;
+        Size   -= N;
+        Offset += N;
+    }
+    return true;
+}
+
+bool WriteZerosAt(int FD, uint64_t Count, uint64_t Offset) {
+    static const char Zeros[4096] = { 0 };
+    while (Count != 0) {
+        size_t N = std::min<uint64_t>(Count, sizeof(Zeros));
+        if (!WriteAt(FD, Zeros, N, Offset)) return false;
+        Count  -= N;
+        Offset += N;
+    }
+    return true;
+}
+#endif
+
+template <class ELFT>
+class ELFCopier {
+    typedef typename ELFFile<ELFT>::Elf_Ehdr Elf_Ehdr;
+    typedef typename ELFFile<ELFT>::Elf_Shdr Elf_Shdr;
+    typedef typename ELFFile<ELFT>::Elf_Phdr Elf_Phdr;
+    typedef typename ELFFile<ELFT>::Elf_Sym  Elf_Sym;
+    typedef support::detail::packed_endian_specific_integral<
+        uint32_t, ELFT::TargetEndianness, support::unaligned> Elf_GroupWord;
+
+public:
+    ELFCopier(StringRef Data, bool (*ShouldRemove)(StringRef SectionName))
+        : mData(Data)
+        , mShouldRemove(ShouldRemove)
+    {
+    }
+
+    bool init(ArrayRef<SectionUpdate> Updates);
+    bool removesSections() const;
+    bool fitsInPlace() const;
+    bool run(raw_ostream &OS);
+#ifdef LLVM_ON_UNIX
+    bool updateInPlace(int FD) const;
+#endif
+
+private:
+    struct CompareOffset {
+        const Elf_Shdr *Shdrs;
+        bool operator()(unsigned A, unsigned B) const { return Shdrs[A].sh_offset < Shdrs[B].sh_offset; }
+    };
+
+    bool fail(const Twine &Message) const {
+        errs() << "ELF output: " << Message << "\n";
+        return false;
+    }
+
+    bool isAlloc(unsigned Index) const {
+        return mShdrs[Index].sh_flags & ELF::SHF_ALLOC;
+    }
+
+    StringRef getContents(unsigned Index) const {
+        return mData.substr(mShdrs[Index].sh_offset, mShdrs[Index].sh_size);
+    }
+
+    StringRef getNewContents(unsigned Index) const {
+        std::map<unsigned, StringRef>::const_iterator Update = mUpdates.find(Index);
+        if (Update != mUpdates.end()) return Update->second;
+        std::map<unsigned, std::string>::const_iterator It = mPatched.find(Index);
+        if (It != mPatched.end()) return It->second;
+        return getContents(Index);
+    }
+
+    bool selectUpdates(ArrayRef<SectionUpdate> Updates);
+    void selectSections();
+    bool patchSections();
+    uint64_t getLoadableEnd() const;
+    void selectCopied(uint64_t LoadableEnd);
+
+    StringRef                           mData;
+    bool                              (*mShouldRemove)(StringRef);
+    const Elf_Ehdr                     *mHeader;
+    const Elf_Shdr                     *mShdrs;
+    unsigned                            mNumSections;
+    unsigned                            mShStrNdx;
+
+    std::vector<bool>                   mRemoved;
+    std::vector<unsigned>               mNewIndex;
+    std::vector<bool>                   mCopied;    // Kept at its offset in the verbatim block.
+    std::map<unsigned, std::string>     mPatched;   // Rewritten section contents.
+    std::map<unsigned, StringRef>       mUpdates;   // --update-section contents.
+};
+
+template <class ELFT>
+bool ELFCopier<ELFT>::init(ArrayRef<SectionUpdate> Updates) {
+    if (mData.size() < sizeof(Elf_Ehdr)) return fail("file too small");
+
+    mHeader      = reinterpret_cast<const Elf_Ehdr *>(mData.data());
+    mNumSections = mHeader->e_shnum;
+    mShStrNdx    = mHeader->e_shstrndx;
+
+    uint64_t ShOff = mHeader->e_shoff;
+    if (   mNumSections == 0
+        || mHeader->e_shentsize != sizeof(Elf_Shdr)
+        || mShStrNdx >= mNumSections
+        || ShOff + uint64_t(mNumSections) * sizeof(Elf_Shdr) > mData.size()) {
+        return fail("unsupported or invalid section header table");
+    }
+    mShdrs = reinterpret_cast<const Elf_Shdr *>(mData.data() + ShOff);
+
+    for (unsigned i = 1; i != mNumSections; ++i) {
+        if (   mShdrs[i].sh_type != ELF::SHT_NOBITS
+            && mShdrs[i].sh_offset + mShdrs[i].sh_size > mData.size()) {
+            return fail("section extends past the end of the file");
+        }
+    }
+
+    selectSections();
+    return selectUpdates(Updates);
+}
+
+template <class ELFT>
+bool ELFCopier<ELFT>::run(raw_ostream &OS) {
+    if (!patchSections()) return false;
+
+    uint64_t LoadableEnd = getLoadableEnd();
+    selectCopied(LoadableEnd);
+
+    // The retained sections outside the verbatim block go after it, in their
+    // original order.
+    std::vector<unsigned> Order;
+    for (unsigned i = 1; i != mNumSections; ++i) {
+        if (!mRemoved[i] && !mCopied[i]) Order.push_back(i);
+    }
+    CompareOffset Compare = { mShdrs };
+    std::stable_sort(Order.begin(), Order.end(), Compare);
+
+    uint64_t              Offset      = LoadableEnd;
+    std::vector<uint64_t> NewOffset(mNumSections);
+    std::vector<uint64_t> NewSize(mNumSections);
+    for (size_t i = 0, e = Order.size(); i != e; ++i) {
+        unsigned Index = Order[i];
+        NewSize[Index] = mShdrs[Index].sh_type == ELF::SHT_NOBITS ? uint64_t(mShdrs[Index].sh_size)
+                                                                  : uint64_t(getNewContents(Index).size());
+        if (mShdrs[Index].sh_type == ELF::SHT_NOBITS) {
+            NewOffset[Index] = Offset;
+            continue;
+        }
+        Offset = RoundUpToAlignment(Offset, std::max<uint64_t>(mShdrs[Index].sh_addralign, 1));
+        NewOffset[Index] = Offset;
+        Offset += NewSize[Index];
+    }
+    uint64_t NewShOff = RoundUpToAlignment(Offset, ELFT::Is64Bits ? 8 : 4);
+
+    unsigned NewNumSections = 0;
+    for (unsigned i = 0; i != mNumSections; ++i) {
+        if (!mRemoved[i]) ++NewNumSections;
+    }
+
+    // ELF header and the loadable part of the file, with the new contents of
+    // any updated allocated sections in it spliced in.
+    Elf_Ehdr Header = *mHeader;
+    Header.e_shoff    = NewShOff;
+    Header.e_shnum    = NewNumSections;
+    Header.e_shstrndx = mNewIndex[mShStrNdx];
+    OS.write(reinterpret_cast<const char *>(&Header), sizeof(Header));
+
+    std::vector<unsigned> Spliced;
+    for (std::map<unsigned, StringRef>::const_iterator It = mUpdates.begin(), E = mUpdates.end(); It != E; ++It) {
+        if (mCopied[It->first]) Spliced.push_back(It->first);
+    }
+    std::sort(Spliced.begin(), Spliced.end(), Compare);
+
+    uint64_t Copied = sizeof(Header);
+    for (size_t i = 0, e = Spliced.size(); i != e; ++i) {
+        unsigned  Index    = Spliced[i];
+        StringRef Contents = mUpdates[Index];
+        if (mShdrs[Index].sh_offset < Copied) return fail("updated section overlaps the ELF header or another updated section");
+
+        OS.write(mData.data() + Copied, mShdrs[Index].sh_offset - Copied);
+        OS << Contents;
+        writeZeros(OS, mShdrs[Index].sh_size - Contents.size());
+        Copied = mShdrs[Index].sh_offset + mShdrs[Index].sh_size;
+    }
+    OS.write(mData.data() + Copied, LoadableEnd - Copied);
+
+    // Sections laid out again.
+    uint64_t Pos = LoadableEnd;
+    for (size_t i = 0, e = Order.size(); i != e; ++i) {
+        unsigned Index = Order[i];
+        if (mShdrs[Index].sh_type == ELF::SHT_NOBITS) continue;
+
+        writeZeros(OS, NewOffset[Index] - Pos);
+        OS << getNewContents(Index);
+        Pos = NewOffset[Index] + NewSize[Index];
+    }
+
+    // Section header table.
+    writeZeros(OS, NewShOff - Pos);
+    for (unsigned i = 0; i != mNumSections; ++i) {
+        if (mRemoved[i]) continue;
+
+        Elf_Shdr Shdr = mShdrs[i];
+        if (i != 0 && !mCopied[i]) {
+            Shdr.sh_offset = NewOffset[i];
+            Shdr.sh_size   = NewSize[i];
+        } else if (mUpdates.count(i)) {
+            Shdr.sh_size   = mUpdates.find(i)->second.size();
+        }
+        if (Shdr.sh_link < mNumSections) {
+            Shdr.sh_link = mNewIndex[Shdr.sh_link];
+        }
+        if (   (   Shdr.sh_type == ELF::SHT_REL || Shdr.sh_type == ELF::SHT_RELA
+                || (Shdr.sh_flags & ELF::SHF_INFO_LINK))
+            && Shdr.sh_info < mNumSections) {
+            Shdr.sh_info = mNewIndex[Shdr.sh_info];
+        }
+        OS.write(reinterpret_cast<const char *>(&Shdr), sizeof(Shdr));
+    }
+
+    return true;
+}
+
+// Look up the sections named in --update-section.  Allocated sections keep
+// their place in the loaded image, so their new contents have to fit in it;
+// non-allocated ones may grow since they are laid out again anyway.
+template <class ELFT>
+bool ELFCopier<ELFT>::selectUpdates(ArrayRef<SectionUpdate> Updates) {
+    StringRef Names = getContents(mShStrNdx);
+
+    for (size_t u = 0, e = Updates.size(); u != e; ++u) {
+        unsigned Index = 0;
+        for (unsigned i = 1; i != mNumSections && Index == 0; ++i) {
+            if (mShdrs[i].sh_name < Names.size() && StringRef(Names.data() + mShdrs[i].sh_name) == Updates[u].Name) {
+                Index = i;
+            }
+        }
+
+        if (Index == 0 || mRemoved[Index]) return fail("no section " + Updates[u].Name + " to update");
+        if (mShdrs[Index].sh_type == ELF::SHT_NOBITS) return fail("cannot update section " + Updates[u].Name + " without file contents");
+        if (isAlloc(Index) && Updates[u].Contents.size() > mShdrs[Index].sh_size) {
+            return fail("new contents of allocated section " + Updates[u].Name + " do not fit");
+        }
+        mUpdates[Index] = Updates[u].Contents;
+    }
+    return true;
+}
+
+template <class ELFT>
+bool ELFCopier<ELFT>::removesSections() const {
+    return std::find(mRemoved.begin(), mRemoved.end(), true) != mRemoved.end();
+}
+
+template <class ELFT>
+bool ELFCopier<ELFT>::fitsInPlace() const {
+    for (std::map<unsigned, StringRef>::const_iterator It = mUpdates.begin(), E = mUpdates.end(); It != E; ++It) {
+        if (It->second.size() > mShdrs[It->first].sh_size) return false;
+    }
+    return true;
+}
+
+#ifdef LLVM_ON_UNIX
+// Write the updated sections into the file they were read from.  Any space
+// left over in a section's extent is cleared, and its header is patched if the
+// size changed.  Nothing else in the file is touched.
+template <class ELFT>
+bool ELFCopier<ELFT>::updateInPlace(int FD) const {
+    for (std::map<unsigned, StringRef>::const_iterator It = mUpdates.begin(), E = mUpdates.end(); It != E; ++It) {
+        const Elf_Shdr &Shdr     = mShdrs[It->first];
+        StringRef       Contents = It->second;
+
+        if (   !WriteAt(FD, Contents.data(), Contents.size(), Shdr.sh_offset)
+            || !WriteZerosAt(FD, Shdr.sh_size - Contents.size(), Shdr.sh_offset + Contents.size())) {
+            return fail("error writing section contents");
+        }
+
+        if (Contents.size() != Shdr.sh_size) {
+            Elf_Shdr NewShdr = Shdr;
+            NewShdr.sh_size  = Contents.size();
+            if (!WriteAt(FD, reinterpret_cast<const char *>(&NewShdr), sizeof(NewShdr),
+                         mHeader->e_shoff + uint64_t(It->first) * sizeof(Elf_Shdr))) {
+                return fail("error writing section header");
+            }
+        }
+    }
+    return true;
+}
+#endif
+
+// Decide which sections to drop.  Allocated sections are always kept since
+// they are part of the loaded image, as is the section name string table.
+// Sections that only make sense together with a dropped one, such as the
+// relocations for a dropped section, are dropped with it.
+template <class ELFT>
+void ELFCopier<ELFT>::selectSections() {
+    StringRef Names = getContents(mShStrNdx);
+
+    mRemoved.assign(mNumSections, false);
+    for (unsigned i = 1; i != mNumSections; ++i) {
+        if (mShdrs[i].sh_name >= Names.size()) continue;
+
+        StringRef Name = Names.data() + mShdrs[i].sh_name;
+        if (!mShouldRemove(Name)) continue;
+
+        if (isAlloc(i)) {
+            errs() << "ELF output: keeping allocated section " << Name << "\n";
+        } else if (i != mShStrNdx) {
+            mRemoved[i] = true;
+        }
+    }
+
+    bool Changed = true;
+    while (Changed) {
+        Changed = false;
+        for (unsigned i = 1; i != mNumSections; ++i) {
+            if (mRemoved[i] || isAlloc(i)) continue;
+
+            unsigned Link = mShdrs[i].sh_link;
+            unsigned Info = mShdrs[i].sh_info;
+            bool     IsRel = mShdrs[i].sh_type == ELF::SHT_REL || mShdrs[i].sh_type == ELF::SHT_RELA;
+            if (   (Link != 0 && Link < mNumSections && mRemoved[Link])
+                || (IsRel && Info != 0 && Info < mNumSections && mRemoved[Info])) {
+                mRemoved[i] = true;
+                Changed     = true;
+            }
+        }
+    }
+
+    mNewIndex.assign(mNumSections, 0);
+    for (unsigned i = 0, Next = 0; i != mNumSections; ++i) {
+        if (!mRemoved[i]) mNewIndex[i] = Next++;
+    }
+}
+
+// Section indices change when sections are dropped, so the retained
+// non-allocated sections that store them are rewritten.  Symbols defined in a
+// dropped section become absolute.  The allocated .dynsym is left alone; the
+// dynamic loader only distinguishes undefined from defined symbols.
+template <class ELFT>
+bool ELFCopier<ELFT>::patchSections() {
+    bool Renumbered = false;
+    for (unsigned i = 0; i != mNumSections; ++i) {
+        if (mNewIndex[i] != i && !mRemoved[i]) Renumbered = true;
+    }
+
+    for (unsigned i = 1; i != mNumSections; ++i) {
+        if (mRemoved[i] || isAlloc(i)) continue;
+
+        switch (mShdrs[i].sh_type) {
+        case ELF::SHT_SYMTAB: {
+            std::string Symbols = getContents(i).str();
+            Elf_Sym    *Sym     = reinterpret_cast<Elf_Sym *>(&Symbols[0]);
+            for (size_t n = 0, e = Symbols.size() / sizeof(Elf_Sym); n != e; ++n) {
+                unsigned Index = Sym[n].st_shndx;
+                if (Index == ELF::SHN_UNDEF || Index >= ELF::SHN_LORESERVE || Index >= mNumSections) continue;
+                Sym[n].st_shndx = mRemoved[Index] ? unsigned(ELF::SHN_ABS) : mNewIndex[Index];
+            }
+            mPatched[i] = Symbols;
+            break;
+        }
+        case ELF::SHT_GROUP: {
+            StringRef     Group = getContents(i);
+            std::string   Members(Group.data(), std::min<size_t>(Group.size(), sizeof(Elf_GroupWord)));
+            const Elf_GroupWord *Word = reinterpret_cast<const Elf_GroupWord *>(Group.data());
+            for (size_t n = 1, e = Group.size() / sizeof(Elf_GroupWord); n < e; ++n) {
+                unsigned Index = Word[n];
+                if (Index >= mNumSections || mRemoved[Index]) continue;
+
+                Elf_GroupWord Member;
+                Member = mNewIndex[Index];
+                Members.append(reinterpret_cast<const char *>(&Member), sizeof(Member));
+            }
+            mPatched[i] = Members;
+            break;
+        }
+        case ELF::SHT_SYMTAB_SHNDX:
+            if (Renumbered) return fail("extended section indices are not supported");
+            break;
+        }
+    }
+    return true;
+}
+
+// End of the part of the file that is copied verbatim: the ELF header,
+// program headers, allocated sections and everything covered by segments.
+// Without program headers that is only the ELF header.
+template <class ELFT>
+uint64_t ELFCopier<ELFT>::getLoadableEnd() const {
+    uint64_t End = sizeof(Elf_Ehdr);
+
+    uint64_t PhOff = mHeader->e_phoff;
+    unsigned PhNum = mHeader->e_phnum;
+    if (PhNum == 0) return End;
+
+    if (PhOff + uint64_t(PhNum) * sizeof(Elf_Phdr) <= mData.size()) {
+        const Elf_Phdr *Phdrs = reinterpret_cast<const Elf_Phdr *>(mData.data() + PhOff);
+        End = std::max<uint64_t>(End, PhOff + uint64_t(PhNum) * sizeof(Elf_Phdr));
+        for (unsigned i = 0; i != PhNum; ++i) {
+            End = std::max<uint64_t>(End, Phdrs[i].p_offset + Phdrs[i].p_filesz);
+        }
+    }
+
+    for (unsigned i = 1; i != mNumSections; ++i) {
+        if (isAlloc(i) && mShdrs[i].sh_type != ELF::SHT_NOBITS) {
+            End = std::max<uint64_t>(End, mShdrs[i].sh_offset + mShdrs[i].sh_size);
+        }
+    }
+
+    return std::min<uint64_t>(End, mData.size());
+}
+
+// Decide which sections keep their offset as part of the verbatim block that
+// ends at LoadableEnd: the allocated sections in it, and non-allocated ones
+// that lie within it and whose contents do not change.  Everything else is
+// laid out again after the block.
+template <class ELFT>
+void ELFCopier<ELFT>::selectCopied(uint64_t LoadableEnd) {
+    mCopied.assign(mNumSections, false);
+    for (unsigned i = 1; i != mNumSections; ++i) {
+        const Elf_Shdr &Shdr = mShdrs[i];
+        uint64_t        End  = Shdr.sh_offset + (Shdr.sh_type == ELF::SHT_NOBITS ? 0 : uint64_t(Shdr.sh_size));
+        if (Shdr.sh_offset < sizeof(Elf_Ehdr) || End > LoadableEnd) continue;
+
+        mCopied[i] = isAlloc(i) || (!mUpdates.count(i) && !mPatched.count(i));
+    }
+}
+
+template <class ELFT>
+bool copyELFImpl(const ELFObjectFile<ELFT> *Obj, StringRef OutputFilename,
+                 bool (*ShouldRemove)(StringRef), ArrayRef<SectionUpdate> Updates) {
+    ELFCopier<ELFT> Copier(Obj->getData(), ShouldRemove);
+    if (!Copier.init(Updates)) return false;
+
+    bool SameFile;
+    if (sys::fs::equivalent(Obj->getFileName(), OutputFilename, SameFile)) SameFile = false;
+
+#ifdef LLVM_ON_UNIX
+    if (SameFile && !Copier.removesSections() && Copier.fitsInPlace()) {
+        int FD = ::open(OutputFilename.str().c_str(), O_WRONLY);
+        if (FD < 0) {
+            errs() << "ELF output: '" << OutputFilename << "': " << strerror(errno) << "\n";
+            return false;
+        }
+        bool Success = Copier.updateInPlace(FD);
+        if (::close(FD) != 0) Success = false;
+        return Success;
+    }
+#endif
+
+    if (!SameFile) {
+        std::string ErrorInfo;
+        tool_output_file Out(OutputFilename.data(), ErrorInfo, sys::fs::F_Binary);
+        if (!ErrorInfo.empty()) {
+            errs() << ErrorInfo << '\n';
+            return false;
+        }
+        if (!Copier.run(Out.os())) return false;
+#ifdef LLVM_ON_UNIX
+        // A new file gets 0666 less the umask; keep the input's permissions,
+        // including the execute bits, as the same-file path below does.
+        struct stat Status;
+        if (OutputFilename != "-" && ::stat(Obj->getFileName().str().c_str(), &Status) == 0) {
+            ::chmod(OutputFilename.str().c_str(), Status.st_mode & 07777);
+        }
+#endif
+        Out.keep();
+        return true;
+    }
+
+    // Truncating the input would pull the data out from under the mapping it
+    // is being copied from, so write a new file and rename it over the input.
+    int              FD;
+    SmallString<128> TempPath;
+    if (error_code ec = sys::fs::createUniqueFile(OutputFilename + "-%%%%%%", FD, TempPath)) {
+        errs() << "ELF output: '" << OutputFilename << "': " << ec.message() << "\n";
+        return false;
+    }
+#ifdef LLVM_ON_UNIX
+    struct stat Status;
+    if (::stat(OutputFilename.str().c_str(), &Status) == 0) ::fchmod(FD, Status.st_mode & 07777);
+#endif
+
+    bool Success;
+    {
+        raw_fd_ostream OS(FD, true);
+        Success = Copier.run(OS);
+        OS.close();
+        if (OS.has_error()) {
+            OS.clear_error();
+            Success = false;
+        }
+    }
+    if (Success) {
+        if (error_code ec = sys::fs::rename(TempPath.str(), OutputFilename)) {
+            errs() << "ELF output: '" << OutputFilename << "': " << ec.message() << "\n";
+            Success = false;
+        }
+    }
+    if (!Success) sys::fs::remove(TempPath.str());
+    return Success;
+}
+
+} // end anonymous namespace
+
+bool llvm::copyELF(ObjectFile *o, StringRef OutputFilename,
+                   bool (*ShouldRemove)(StringRef SectionName),
+                   ArrayRef<SectionUpdate> Updates) {
+    if (const ELF32LEObjectFile *ELFObj = dyn_cast<ELF32LEObjectFile>(o)) {
+        return copyELFImpl(ELFObj, OutputFilename, ShouldRemove, Updates);
+    } else if (const ELF32BEObjectFile *ELFObj = dyn_cast<ELF32BEObjectFile>(o)) {
+        return copyELFImpl(ELFObj, OutputFilename, ShouldRemove, Updates);
+    } else if (const ELF64LEObjectFile *ELFObj = dyn_cast<ELF64LEObjectFile>(o)) {
+        return copyELFImpl(ELFObj, OutputFilename, ShouldRemove, Updates);
+    } else if (const ELF64BEObjectFile *ELFObj = dyn_cast<ELF64BEObjectFile>(o)) {
+        return copyELFImpl(ELFObj, OutputFilename, ShouldRemove, Updates);
+    }
+
+    errs() << "ELF output requires an ELF input file\n";
+    return false;
+}
@@ -0,0 +1,125 @@
+//===-- PEImage.cpp - PE image section layout -----------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the lookup of where the sections of a PE image are
+// loaded.  The headers are read directly, as COFFObjectFile only knows the
+// PE32 optional header, and UEFI images for x86-64 and AArch64 are PE32+:
+//
+//   "MZ" DOS header, with the offset of the PE header at 0x3c
+//   "PE\0\0", COFF file header, optional header, section table
+//
+// The optional header starts with its magic, 0x10b for PE32 or 0x20b for
+// PE32+, which decides the size and place of ImageBase.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm-objcopy.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/Endian.h"
+#include <algorithm>
+
+using namespace llvm;
+using namespace object;
+using support::ulittle16_t;
+using support::ulittle32_t;
+using support::ulittle64_t;
+
+namespace {
+
+const uint32_t PEMagic                   = 0x00004550;     // "PE\0\0"
+const uint16_t PE32Magic                 = 0x10b;
+const uint16_t PE32PlusMagic             = 0x20b;
+const uint32_t IMAGE_SCN_MEM_DISCARDABLE = 0x02000000;
+
+struct PEHeader {
+    ulittle32_t Signature;
+    ulittle16_t Machine;
+    ulittle16_t NumberOfSections;
+    ulittle32_t TimeDateStamp;
+    ulittle32_t PointerToSymbolTable;
+    ulittle32_t NumberOfSymbols;
+    ulittle16_t SizeOfOptionalHeader;
+    ulittle16_t Characteristics;
+};
+
+struct SectionHeader {
+    char        Name[8];
+    ulittle32_t VirtualSize;
+    ulittle32_t VirtualAddress;
+    ulittle32_t SizeOfRawData;
+    ulittle32_t PointerToRawData;
+    ulittle32_t PointerToRelocations;
+    ulittle32_t PointerToLinenumbers;
+    ulittle16_t NumberOfRelocations;
+    ulittle16_t NumberOfLinenumbers;
+    ulittle32_t Characteristics;
+};
+
+template <typename T>
+const T *Get(StringRef Data, uint64_t Offset) {
+    if (Offset > Data.size() || Data.size() - Offset < sizeof(T)) return NULL;
+    return reinterpret_cast<const T *>(Data.data() + Offset);
+}
+
+} // end anonymous namespace
+
+PEImage::PEImage(ObjectFile *o)
+    : mIsImage(false)
+    , mImageBase(0)
+{
+    if (!o->isCOFF()) return;
+
+    StringRef Data = o->getData();
+    if (!Data.startswith("MZ")) return;
+
+    const ulittle32_t *PEOffset = Get<ulittle32_t>(Data, 0x3c);
+    if (PEOffset == NULL) return;
+    const PEHeader *Header = Get<PEHeader>(Data, *PEOffset);
+    if (Header == NULL || Header->Signature != PEMagic) return;
+
+    uint64_t           OptionalOffset = uint64_t(*PEOffset) + sizeof(PEHeader);
+    const ulittle16_t *Magic          = Get<ulittle16_t>(Data, OptionalOffset);
+    uint64_t           ImageBase;
+    if (Magic == NULL || Header->SizeOfOptionalHeader < 32) return;
+    if (*Magic == PE32Magic) {
+        const ulittle32_t *Base = Get<ulittle32_t>(Data, OptionalOffset + 28);
+        if (Base == NULL) return;
+        ImageBase = *Base;
+    } else if (*Magic == PE32PlusMagic) {
+        const ulittle64_t *Base = Get<ulittle64_t>(Data, OptionalOffset + 24);
+        if (Base == NULL) return;
+        ImageBase = *Base;
+    } else {
+        return;
+    }
+
+    mImageBase = ImageBase;
+
+    uint64_t TableOffset = OptionalOffset + Header->SizeOfOptionalHeader;
+    for (unsigned i = 0, e = Header->NumberOfSections; i != e; ++i) {
+        const SectionHeader *Shdr = Get<SectionHeader>(Data, TableOffset + i * sizeof(SectionHeader));
+        if (Shdr == NULL) return;
+
+        // Raw data is padded to the file alignment, so beyond VirtualSize it
+        // is not part of the section.  A VirtualSize of zero is taken to
+        // mean the raw size.
+        uint64_t RawOffset = std::min<uint64_t>(Shdr->PointerToRawData, Data.size());
+        Section  S;
+        S.Address     = ImageBase + Shdr->VirtualAddress;
+        S.Size        = Shdr->VirtualSize != 0 ? uint32_t(Shdr->VirtualSize) : uint32_t(Shdr->SizeOfRawData);
+        S.Contents    = Data.substr(RawOffset, std::min<uint64_t>(Shdr->SizeOfRawData, S.Size));
+        S.Discardable = (Shdr->Characteristics & IMAGE_SCN_MEM_DISCARDABLE) != 0;
+        mSections.push_back(S);
+    }
+    mIsImage = true;
+}
+
+const PEImage::Section *PEImage::getSection(unsigned Index) const {
+    return Index < mSections.size() ? &mSections[Index] : NULL;
+}
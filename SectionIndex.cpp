@@ -0,0 +1,94 @@
+//===-- SectionIndex.cpp - ELF section header index -----------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the one-pass read of an ELF section header table into
+// the arrays of ELFSectionIndex.  Files with -ffunction-sections and
+// -fdata-sections can have hundreds of thousands of sections, which is past
+// what the 16-bit header fields can count; then e_shnum is zero and the count
+// is the sh_size of section 0, and e_shstrndx is SHN_XINDEX and the index of
+// the section name table is its sh_link.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm-objcopy.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Support/ELF.h"
+
+using namespace llvm;
+using namespace object;
+
+ELFSectionIndex::ELFSectionIndex(ObjectFile *o)
+    : mValid(false)
+{
+    if (const ELF32LEObjectFile *ELFObj = dyn_cast<ELF32LEObjectFile>(o)) {
+        mValid = read<ELFType<support::little, 4, false> >(ELFObj->getData());
+    } else if (const ELF32BEObjectFile *ELFObj = dyn_cast<ELF32BEObjectFile>(o)) {
+        mValid = read<ELFType<support::big, 4, false> >(ELFObj->getData());
+    } else if (const ELF64LEObjectFile *ELFObj = dyn_cast<ELF64LEObjectFile>(o)) {
+        mValid = read<ELFType<support::little, 8, true> >(ELFObj->getData());
+    } else if (const ELF64BEObjectFile *ELFObj = dyn_cast<ELF64BEObjectFile>(o)) {
+        mValid = read<ELFType<support::big, 8, true> >(ELFObj->getData());
+    }
+}
+
+template <class ELFT>
+bool ELFSectionIndex::read(StringRef Data) {
+    typedef typename ELFFile<ELFT>::Elf_Ehdr Elf_Ehdr;
+    typedef typename ELFFile<ELFT>::Elf_Shdr Elf_Shdr;
+
+    if (Data.size() < sizeof(Elf_Ehdr)) return false;
+    const Elf_Ehdr *Header = reinterpret_cast<const Elf_Ehdr *>(Data.data());
+
+    uint64_t ShOff = Header->e_shoff;
+    if (   ShOff == 0
+        || Header->e_shentsize != sizeof(Elf_Shdr)
+        || ShOff > Data.size()
+        || Data.size() - ShOff < sizeof(Elf_Shdr)) {
+        return false;
+    }
+    const Elf_Shdr *Shdrs = reinterpret_cast<const Elf_Shdr *>(Data.data() + ShOff);
+
+    uint64_t ShNum    = Header->e_shnum;
+    uint64_t ShStrNdx = Header->e_shstrndx;
+    if (ShNum == 0) ShNum = Shdrs[0].sh_size;
+    if (ShStrNdx == ELF::SHN_XINDEX) ShStrNdx = Shdrs[0].sh_link;
+    if ((Data.size() - ShOff) / sizeof(Elf_Shdr) < ShNum || ShStrNdx >= ShNum) return false;
+
+    const Elf_Shdr &StrTab = Shdrs[ShStrNdx];
+    if (StrTab.sh_offset > Data.size() || Data.size() - StrTab.sh_offset < StrTab.sh_size) return false;
+    mNames = Data.substr(StrTab.sh_offset, StrTab.sh_size);
+    mData  = Data;
+
+    mNameOffsets.resize(ShNum);
+    mAddresses.resize(ShNum);
+    mSizes.resize(ShNum);
+    mOffsets.resize(ShNum);
+    mFlags.resize(ShNum);
+    for (uint64_t i = 0; i != ShNum; ++i) {
+        const Elf_Shdr &Shdr = Shdrs[i];
+        mNameOffsets[i] = Shdr.sh_name;
+        mAddresses[i]   = Shdr.sh_addr;
+        mSizes[i]       = Shdr.sh_size;
+        mOffsets[i]     = Shdr.sh_offset;
+        mFlags[i]       =   (Shdr.sh_flags & ELF::SHF_ALLOC   ? Allocated : 0)
+                          | (Shdr.sh_type == ELF::SHT_NOBITS ? NoBits    : 0);
+    }
+    return true;
+}
+
+StringRef ELFSectionIndex::getName(size_t i) const {
+    StringRef Name = mNames.substr(mNameOffsets[i]);
+    return Name.substr(0, Name.find('\0'));
+}
+
+bool ELFSectionIndex::getContents(size_t i, StringRef &Contents) const {
+    if (mOffsets[i] > mData.size() || mData.size() - mOffsets[i] < mSizes[i]) return false;
+    Contents = mData.substr(mOffsets[i], mSizes[i]);
+    return true;
+}
@@ -12,43 +12,243 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm-objcopy.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/Triple.h"
+#include "llvm/Config/config.h"
 #include "llvm/Object/Archive.h"
 #include "llvm/Object/COFF.h"
 #include "llvm/Object/MachO.h"
+#include "llvm/Object/MachOUniversal.h"
 #include "llvm/Object/ObjectFile.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Format.h"
+#include "llvm/Support/Host.h"
 #include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/PrettyStackTrace.h"
+#include "llvm/Support/Regex.h"
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/system_error.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#ifdef LLVM_ON_UNIX
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
 
 using namespace llvm;
 using namespace object;
 
-static cl::opt<std::string>
-InputFilename(cl::Positional, cl::desc("<input object file>"), cl::Required);
+static cl::list<std::string>
+InputFilenames(cl::Positional, cl::desc("<input object files>"), cl::OneOrMore);
 static cl::opt<std::string>
 OutputFilename(cl::Positional, cl::desc("<output object file>"), cl::Required);
 
 namespace {
-    enum OutputFormatTy { binary, intel_hex, readmemh };
+    enum InputFormatTy { object, binary_input };
+    cl::opt<InputFormatTy>
+        InputTarget("I",
+                cl::desc("Specify input target"),
+                cl::values(clEnumVal(object, "object file"),
+                           clEnumValN(binary_input, "binary", "raw binary data, wrapped in a relocatable ELF object (-O elf)"),
+                           clEnumValEnd),
+                cl::init(object));
+    cl::alias InputTarget2("input-target", cl::desc("Alias for -I"),
+            cl::aliasopt(InputTarget));
+
+    cl::opt<std::string>
+        BinaryArchitecture("binary-architecture",
+                           cl::desc("Architecture of the object made from -I binary input (default: host)"),
+                           cl::value_desc("arch"), cl::init(sys::getDefaultTargetTriple()));
+    cl::alias BinaryArchitecture2("B", cl::desc("Alias for --binary-architecture"),
+            cl::aliasopt(BinaryArchitecture));
+
+    cl::opt<std::string>
+        SliceArch("arch",
+                  cl::desc("Slice to use from a Mach-O universal input (default: convert each slice to its own output)"),
+                  cl::value_desc("arch"));
+
+    enum OutputFormatTy { binary, binary_lz4, intel_hex, readmemh, c_array, assembly, elf };
     cl::opt<OutputFormatTy>
         OutputTarget("O",
                 cl::desc("Specify output target"),
                 cl::values(clEnumVal(binary,    "raw binary"),
+                           clEnumVal(binary_lz4, "raw binary in independently LZ4-compressed blocks, with a block index"),
                            clEnumVal(intel_hex, "Intel Hex format"),
                            clEnumVal(readmemh,  "Format read by Verilog's $readmemh system task"),
+                           clEnumVal(c_array,   "raw binary as a C array definition"),
+                           clEnumValN(assembly, "asm", "raw binary as assembler data directives, or an .incbin of --incbin"),
+                           clEnumVal(elf,       "ELF file with the removed non-allocated sections left out"),
                            clEnumValEnd),
                 cl::init(binary));
     cl::alias OutputTarget2("output-target", cl::desc("Alias for -O"),
             cl::aliasopt(OutputTarget));
 
+    cl::opt<bool>
+        Verify("verify",
+               cl::desc("Compare the generated output against the existing output file instead of writing it"));
+
+    cl::opt<bool>
+        OnlyIfChanged("only-if-changed",
+                      cl::desc("Leave the output file untouched if its contents would not change"));
+
+    cl::list<std::string>
+        OnlySections("only-section",
+                     cl::desc("Only copy sections whose name matches the given glob"),
+                     cl::value_desc("section"), cl::ZeroOrMore);
+    cl::alias OnlySections2("j", cl::desc("Alias for --only-section"),
+            cl::aliasopt(OnlySections));
+
+    cl::list<std::string>
+        RemoveSections("remove-section",
+                       cl::desc("Do not copy sections whose name matches the given glob"),
+                       cl::value_desc("section"), cl::ZeroOrMore);
+    cl::alias RemoveSections2("R", cl::desc("Alias for --remove-section"),
+            cl::aliasopt(RemoveSections));
+
+    cl::list<std::string>
+        AddressRanges("address-range",
+                      cl::desc("Only copy the parts of sections that lie in [start, end)"),
+                      cl::value_desc("start-end"), cl::ZeroOrMore);
+
+    cl::list<std::string>
+        ExtraOutputs("extra-output",
+                     cl::desc("Also write the image in another format from the same pass, e.g. intel_hex=out.hex"),
+                     cl::value_desc("format=file"), cl::ZeroOrMore);
+
+    cl::opt<unsigned>
+        OutputBufferSize("output-buffer-size",
+                         cl::desc("Size in bytes of the buffer used for writing output files"),
+                         cl::init(4 << 20));
+
+    cl::opt<std::string>
+        MemoryLimit("memory-limit",
+                    cl::desc("Cap the memory used for buffers, whatever the size of the input, e.g. 256M"),
+                    cl::value_desc("size"));
+
+    cl::opt<unsigned>
+        CompressBlockSize("compress-block-size",
+                          cl::desc("Size in bytes of the uncompressed blocks of binary_lz4 output"),
+                          cl::init(64 << 10));
+
+    cl::opt<std::string>
+        ArrayName("array-name",
+                  cl::desc("Symbol name for c_array and asm output (default: derived from the input file name)"),
+                  cl::value_desc("name"));
+
+    cl::opt<unsigned>
+        ArrayElementWidth("array-element-width",
+                          cl::desc("Bytes per element of c_array and asm output: 1, 2, 4 or 8"),
+                          cl::init(1));
+
+    cl::opt<std::string>
+        IncbinFile("incbin",
+                   cl::desc("Make asm output include this binary image with .incbin instead of listing the data"),
+                   cl::value_desc("filename"));
+
+    cl::opt<bool>
+        DirectIO("direct-io",
+                 cl::desc("Write the output file with O_DIRECT, bypassing the page cache"));
+
+    cl::opt<bool>
+        PopulateInput("populate-input",
+                      cl::desc("Read input files in completely as soon as they are mapped (MAP_POPULATE)"));
+
+    cl::opt<bool>
+        HugePageInput("huge-page-input",
+                      cl::desc("Ask for transparent huge pages for the mappings of input files"));
+
+    cl::opt<bool>
+        BufferStats("buffer-stats",
+                    cl::desc("Report how many encoding buffers were requested, allocated and held"));
+
+    cl::opt<unsigned>
+        Threads("threads",
+                cl::desc("Number of threads working on outputs, their blocks and compressed sections (0 = one per core)"),
+                cl::init(0));
+
+    cl::opt<unsigned>
+        GapFill("gap-fill",
+                cl::desc("Byte value used to fill gaps between sections, and the erase value for --skip-erased"),
+                cl::init(0));
+
+    cl::opt<bool>
+        SkipErased("skip-erased",
+                   cl::desc("Leave out data equal to the --gap-fill value: skip such Intel Hex and readmemh records and trim it from the end of binary output"));
+
+    cl::opt<std::string>
+        FlashLayoutSpec("flash-layout",
+                        cl::desc("Pad data in flash out to whole sectors, e.g. 0x08000000:16Kx4,64K,128Kx7"),
+                        cl::value_desc("base:size[xcount],..."));
+
+    cl::opt<std::string>
+        FlashManifest("flash-manifest",
+                      cl::desc("Write the list of flash sectors that contain data to this file"),
+                      cl::value_desc("filename"));
+
+    cl::list<std::string>
+        MemoryRegions("region",
+                      cl::desc("Write the sections starting in [start, end) to a separate output file"),
+                      cl::value_desc("start-end=file"), cl::ZeroOrMore);
+
+    cl::opt<std::string>
+        PersonalizeCSV("personalize",
+                       cl::desc("Also write one copy of the output per device, patching the symbols listed in this CSV file"),
+                       cl::value_desc("csv"));
+
+    cl::opt<std::string>
+        DeltaFrom("delta-from",
+                  cl::desc("Write a delta from the binary image of this older object file to the current one"),
+                  cl::value_desc("object file"));
+
+    cl::opt<std::string>
+        DeltaOutput("delta-output",
+                    cl::desc("Output file for --delta-from"),
+                    cl::value_desc("filename"));
+
+    cl::opt<std::string>
+        DeltaManifest("delta-manifest",
+                      cl::desc("Write sizes, checksums and statistics of the --delta-from delta to this file"),
+                      cl::value_desc("filename"));
+
+    cl::opt<bool>
+        StripDebug("strip-debug",
+                   cl::desc("With -O elf, remove debugging sections"));
+
+    cl::list<std::string>
+        UpdateSections("update-section",
+                       cl::desc("With -O elf, replace the contents of a section with those of a file; done in place when the output is the input file and the contents fit"),
+                       cl::value_desc("section=file"), cl::ZeroOrMore);
+
     static StringRef ToolName;
 }
 
@@ -59,230 +259,2986 @@ bool llvm::error(error_code ec) {
     return true;
 }
 
-class ObjectCopyBase {
+void llvm::writeZeros(raw_ostream &OS, uint64_t Count) {
+    static const char Zeros[64] = { 0 };
+    while (Count != 0) {
+        size_t N = std::min<uint64_t>(Count, sizeof(Zeros));
+        OS.write(Zeros, N);
+        Count -= N;
+    }
+}
+
+// Translate a shell-style glob ('*', '?' and '[...]' character classes) into
+// the equivalent anchored regular expression.
+static std::string GlobToRegex(StringRef Glob) {
+    std::string Result;
+    for (size_t i = 0, e = Glob.size(); i != e; ++i) {
+        char C = Glob[i];
+        if (C == '*') {
+            Result += ".*";
+        } else if (C == '?') {
+            Result += '.';
+        } else if (C == '[' && Glob.find(']', i + 1) != StringRef::npos) {
+            size_t End = Glob.find(']', i + 1);
+            StringRef Class = Glob.slice(i + 1, End);
+            Result += '[';
+            if (Class.startswith("!")) {
+                Result += '^';
+                Class = Class.drop_front();
+            }
+            Result += Class;
+            Result += ']';
+            i = End;
+        } else {
+            if (strchr("()[]^$|+.{}\\", C)) Result += '\\';
+            Result += C;
+        }
+    }
+    return Result;
+}
+
+// Decides which sections, and which parts of them, are copied.  All glob
+// patterns of a kind are combined into a single regular expression which is
+// compiled once, and every test only needs the section header fields (name,
+// address and size), so the contents of rejected sections are never read.
+class SectionFilter {
 public:
-    ObjectCopyBase(StringRef InputFilename) 
-        : mBinaryOutput(false)
-        , mFillGaps(false)
-    {
+    SectionFilter() {}
+
+    typedef SmallVector<std::pair<uint64_t, uint64_t>, 1> AddressParts;
+
+    bool init(ArrayRef<std::string> Only, ArrayRef<std::string> Remove,
+              ArrayRef<std::string> Ranges) {
+        if (!compile(Only, mOnly)) return false;
+        if (!compile(Remove, mRemove)) return false;
+
+        for (size_t i = 0, e = Only.size(); i != e; ++i) {
+            if (Only[i].find_first_of("*?[") == std::string::npos) mOnlyNames.push_back(Only[i]);
+        }
+
+        for (size_t i = 0, e = Ranges.size(); i != e; ++i) {
+            std::pair<StringRef, StringRef> Bounds = StringRef(Ranges[i]).split('-');
+            uint64_t Begin, End;
+            if (   Bounds.first.getAsInteger(0, Begin)
+                || Bounds.second.getAsInteger(0, End)
+                || End <= Begin) {
+                errs() << ToolName << ": invalid address range '" << Ranges[i] << "'\n";
+                return false;
+            }
+            mRanges.push_back(std::make_pair(Begin, End));
+        }
+
+        // Merge ranges that overlap or touch, so that no byte is selected
+        // twice and the parts of a section come out in address order.
+        std::sort(mRanges.begin(), mRanges.end());
+        size_t Merged = 0;
+        for (size_t i = 0, e = mRanges.size(); i != e; ++i) {
+            if (Merged != 0 && mRanges[i].first <= mRanges[Merged - 1].second) {
+                mRanges[Merged - 1].second = std::max(mRanges[Merged - 1].second, mRanges[i].second);
+            } else {
+                mRanges[Merged++] = mRanges[i];
+            }
+        }
+        mRanges.resize(Merged);
+        return true;
+    }
+
+    bool selectName(StringRef Name) const {
+        if (mOnly && !mOnly->match(Name)) return false;
+        if (mRemove && mRemove->match(Name)) return false;
+        return true;
+    }
+
+    // Whether Name was given literally to --only-section, which also selects
+    // sections that are not part of the loaded image.
+    bool namesExplicitly(StringRef Name) const {
+        return    std::find(mOnlyNames.begin(), mOnlyNames.end(), Name) != mOnlyNames.end()
+               && selectName(Name);
     }
-    virtual ~ObjectCopyBase() {}
 
-    void CopyTo(ObjectFile *o, StringRef OutputFilename) const {
-        if (o == NULL) {
+    // The parts of [Begin, Begin + Size) covered by the address ranges, as
+    // (address, size) pairs in address order; the whole of it if there are
+    // no ranges.  A section spanning several ranges gives one part for each.
+    void selectAddress(uint64_t Begin, uint64_t Size, AddressParts &Parts) const {
+        Parts.clear();
+        if (mRanges.empty()) {
+            Parts.push_back(std::make_pair(Begin, Size));
             return;
         }
 
-        std::string ErrorInfo;
+        uint64_t End = Begin + Size;
+        for (size_t i = 0, e = mRanges.size(); i != e; ++i) {
+            if (mRanges[i].first >= End || mRanges[i].second <= Begin) continue;
 
-        tool_output_file Out(OutputFilename.data(), ErrorInfo, mBinaryOutput ? sys::fs::F_Binary : sys::fs::F_None);
-        if (!ErrorInfo.empty()) {
-            errs() << ErrorInfo << '\n';
-            return;
+            uint64_t PartBegin = std::max(Begin, mRanges[i].first);
+            uint64_t PartEnd   = std::min(End, mRanges[i].second);
+            Parts.push_back(std::make_pair(PartBegin, PartEnd - PartBegin));
         }
+    }
 
-        error_code  ec;
-        bool        FillNextGap = false;
-        uint64_t    LastAddress;
-        StringRef   LastSectionName;
+private:
+    bool compile(ArrayRef<std::string> Globs, OwningPtr<Regex> &Result) {
+        if (Globs.empty()) return true;
 
-        for (section_iterator si = o->begin_sections(), se = o->end_sections(); si != se; si.increment(ec)) {
-            if (error(ec)) return;
+        std::string Pattern = "^(";
+        for (size_t i = 0, e = Globs.size(); i != e; ++i) {
+            if (i != 0) Pattern += '|';
+            Pattern += GlobToRegex(Globs[i]);
+        }
+        Pattern += ")$";
 
-            StringRef SectionName;
-            StringRef SectionContents;
-            uint64_t  SectionAddress;
-            bool      BSS;
-            bool      Required;
+        Result.reset(new Regex(Pattern));
+        std::string Error;
+        if (!Result->isValid(Error)) {
+            errs() << ToolName << ": invalid section pattern: " << Error << "\n";
+            return false;
+        }
+        return true;
+    }
 
-            if (error(si->getName(SectionName))) return;
-            if (error(si->getContents(SectionContents))) return;
-            if (error(si->getAddress(SectionAddress))) return;
-            if (error(si->isBSS(BSS))) continue;
-            if (error(si->isRequiredForExecution(Required))) continue;
+    OwningPtr<Regex>                                mOnly;
+    OwningPtr<Regex>                                mRemove;
+    std::vector<std::string>                        mOnlyNames;
+    std::vector<std::pair<uint64_t, uint64_t> >     mRanges;
+};
 
-            if (   !Required
-                || BSS
-                || SectionContents.size() == 0) {
-                continue;
-            }
+static SectionFilter Filter;
 
-            if (FillNextGap) {
-                if (SectionAddress < LastAddress) {
-                    errs() << "Trying to fill gaps between sections " << LastSectionName << " and " << SectionName << " in invalid order\n";
-                    return;
-                } else if (SectionAddress == LastAddress) {
-                    // No gap, do nothing
-                } else if (SectionAddress - LastAddress > (1<<16)) {
-                    // Gap size limit reached
-                    errs() << "Gap between sections is too large\n";
-                    return;
-                } else {
-                    FillGap(Out, 0x00, SectionAddress - LastAddress);
-                }
-            }
+// Byte order of the first input, used to group the bytes of c_array and asm
+// output into elements.
+static bool ElementsBigEndian = false;
 
-            PrintSection(Out, SectionName, SectionContents, SectionAddress);
+// --memory-limit, the part of it inflated sections may take, the least a
+// thread needs, and the part of its share for the LZ4 batch of an output
+// (see ApplyMemoryLimit and SplitMemoryBudget).  Zero without a limit.
+static uint64_t MemoryBudget  = 0;
+static uint64_t InflateMemory = 0;
+static uint64_t ShareMinimum  = 0;
+static uint64_t BatchMemory   = 0;
 
-            if (mFillGaps) {
-                FillNextGap     = true;
-                LastSectionName = SectionName;
-                LastAddress     = SectionAddress + SectionContents.size();
+// The --threads worker pool, started on first use and shared by every
+// ParallelFor, nested ones included: an output written on a worker queues its
+// Intel Hex pieces or LZ4 blocks on the same pool, so however the work is
+// nested, no more than --threads threads run it and none are created after
+// the first call.  The thread calling ParallelFor counts as one of them.
+// --threads can still be lowered once the pool is running (see
+// SplitMemoryBudget); the workers beyond it then stay idle.
+class WorkerPool {
+public:
+    WorkerPool()
+        : mLimit(0)
+        , mRunning(0)
+        , mStarted(false)
+        , mStop(false)
+    {
+    }
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> Lock(mLock);
+            mStop = true;
+        }
+        mReady.notify_all();
+        for (size_t i = 0, e = mWorkers.size(); i != e; ++i) {
+            mWorkers[i].join();
+        }
+    }
+
+    // Run no more than NumThreads - 1 tasks at once, besides the threads
+    // that call ParallelFor.
+    void limit(unsigned NumThreads) {
+        std::lock_guard<std::mutex> Lock(mLock);
+        mLimit = NumThreads - 1;
+    }
+
+    // Queue Copies calls of Task.
+    void queue(const std::function<void()> &Task, unsigned Copies) {
+        {
+            std::lock_guard<std::mutex> Lock(mLock);
+            if (!mStarted) start();
+            mTasks.insert(mTasks.end(), Copies, Task);
+        }
+        mReady.notify_all();
+    }
+
+private:
+    void start() {
+        unsigned NumThreads = Threads ? unsigned(Threads) : std::thread::hardware_concurrency();
+        for (unsigned i = 1; i < NumThreads; ++i) {
+            mWorkers.push_back(std::thread([this]() { run(); }));
+        }
+        mLimit   = mWorkers.size();
+        mStarted = true;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> Lock(mLock);
+        for (;;) {
+            mReady.wait(Lock, [this]() { return mStop || (!mTasks.empty() && mRunning < mLimit); });
+            if (mTasks.empty()) return;
+
+            std::function<void()> Task;
+            Task.swap(mTasks.front());
+            mTasks.pop_front();
+            ++mRunning;
+            Lock.unlock();
+            Task();
+            Lock.lock();
+            --mRunning;
+        }
+    }
+
+    std::mutex                          mLock;
+    std::condition_variable             mReady;
+    std::deque<std::function<void()> >  mTasks;
+    std::vector<std::thread>            mWorkers;
+    size_t                              mLimit;
+    size_t                              mRunning;
+    bool                                mStarted;
+    bool                                mStop;
+};
+
+static WorkerPool Pool;
+
+// Call Work(0) ... Work(Count - 1) on up to --threads threads of the pool,
+// including the calling one.  Returns false if any call did.
+//
+// Each thread claims the next index until there are none left; the caller
+// then waits for the calls still running elsewhere.  Helpers that only get
+// a worker after that find nothing to claim, which is why the job is shared
+// with them rather than living on the caller's stack.
+template <typename WorkFn>
+static bool ParallelFor(size_t Count, WorkFn Work) {
+    struct Job {
+        std::atomic<size_t>         Next;
+        std::atomic<size_t>         Done;
+        std::atomic<bool>           Success;
+        size_t                      Count;
+        std::function<bool(size_t)> Work;
+        std::mutex                  Lock;
+        std::condition_variable     Finished;
+
+        void run() {
+            for (size_t i = Next++; i < Count; i = Next++) {
+                if (!Work(i)) Success = false;
+                if (++Done == Count) {
+                    std::lock_guard<std::mutex> Guard(Lock);
+                    Finished.notify_all();
+                }
             }
         }
+    };
 
-        Out.keep();
+    if (Count == 0) return true;
+
+    std::shared_ptr<Job> J(new Job);
+    J->Next    = 0;
+    J->Done    = 0;
+    J->Success = true;
+    J->Count   = Count;
+    J->Work    = Work;
+
+    unsigned NumThreads = Threads ? unsigned(Threads) : std::thread::hardware_concurrency();
+    NumThreads = std::max(1u, std::min<unsigned>(NumThreads, Count));
+    if (NumThreads > 1) Pool.queue([J]() { J->run(); }, NumThreads - 1);
+
+    J->run();
+    std::unique_lock<std::mutex> Lock(J->Lock);
+    J->Finished.wait(Lock, [&]() { return J->Done == J->Count; });
+    return J->Success;
+}
+
+// Encoding buffers for LZ4 blocks and Intel Hex pieces, handed out and taken
+// back rather than allocated and freed for every one.  A buffer keeps its
+// capacity in the pool, so once as many buffers as are used at once have
+// grown to size, encoding allocates nothing more, however many outputs,
+// slices and inputs are converted.  Shared by all threads, hence the lock.
+class BufferPool {
+public:
+    BufferPool()
+        : mRequests(0)
+        , mInUse(0)
+        , mPeakInUse(0)
+    {
     }
+    ~BufferPool() { DeleteContainerPointers(mFree); }
 
+    // Return an empty buffer.
+    std::string *acquire() {
+        std::lock_guard<std::mutex> Lock(mLock);
+        ++mRequests;
+        mPeakInUse = std::max(mPeakInUse, ++mInUse);
+        if (mFree.empty()) return new std::string;
 
-protected:
-    virtual void PrintSection(tool_output_file &Out, const StringRef &SectionName,
-                              const StringRef &SectionContents, uint64_t SectionAddress) const = 0;
-    virtual void FillGap(tool_output_file &Out, unsigned char Value, uint64_t Size) const { }
+        std::string *Buffer = mFree.back();
+        mFree.pop_back();
+        return Buffer;
+    }
 
-    bool                  mBinaryOutput;
-    bool                  mFillGaps;
+    // Under --memory-limit the memory of the buffer is given back, so that
+    // only buffers in use take any.
+    void release(std::string *Buffer) {
+        if (MemoryBudget != 0) {
+            std::string().swap(*Buffer);
+        } else {
+            Buffer->clear();
+        }
+        std::lock_guard<std::mutex> Lock(mLock);
+        --mInUse;
+        mFree.push_back(Buffer);
+    }
+
+    // Once every buffer is back, the bytes they hold are the most the pool
+    // has held at any time: buffers only ever grow.
+    void printStats(raw_ostream &OS) {
+        std::lock_guard<std::mutex> Lock(mLock);
+        uint64_t Bytes = 0;
+        for (size_t i = 0, e = mFree.size(); i != e; ++i) {
+            Bytes += mFree[i]->capacity();
+        }
+        OS << "buffer pool: " << mRequests << " requests, " << mPeakInUse << " buffers allocated, "
+           << Bytes << " bytes held\n";
+    }
+
+private:
+    std::mutex                  mLock;
+    std::vector<std::string *>  mFree;
+    uint64_t                    mRequests;
+    size_t                      mInUse;
+    size_t                      mPeakInUse;
 };
 
-class ObjectCopyIntelHex : public ObjectCopyBase {
+static BufferPool Buffers;
+
+// Output stream that, rather than writing anything, compares the bytes it is
+// given against the contents of an existing file.  The comparison is done one
+// buffer-full at a time, so the generated image is never held in memory.
+class ComparingOstream : public raw_ostream {
 public:
-    ObjectCopyIntelHex(StringRef InputFilename) 
-        : ObjectCopyBase(InputFilename) {}
-    virtual ~ObjectCopyIntelHex() {}
+    ComparingOstream(StringRef Expected)
+        : mExpected(Expected)
+        , mPos(0)
+        , mMismatch(UINT64_MAX)
+    {
+        SetBufferSize(1 << 16);
+    }
+    virtual ~ComparingOstream() { flush(); }
+
+    // Returns true if the bytes written so far differ from the expected
+    // contents, either in value or in length.
+    bool differs() {
+        flush();
+        return mMismatch != UINT64_MAX || mPos != mExpected.size();
+    }
+
+    // Offset of the first byte that differs.  Only meaningful if differs().
+    uint64_t firstDifference() {
+        flush();
+        if (mMismatch != UINT64_MAX) return mMismatch;
+        return std::min<uint64_t>(mPos, mExpected.size());
+    }
 
 protected:
-    virtual void PrintSection(tool_output_file &Out, const StringRef &SectionName,
-                              const StringRef &SectionContents, uint64_t SectionAddress) const
+    virtual void write_impl(const char *Ptr, size_t Size) {
+        if (mMismatch == UINT64_MAX && mPos < mExpected.size()) {
+            size_t      Avail    = std::min<uint64_t>(Size, mExpected.size() - mPos);
+            const char *Expected = mExpected.data() + mPos;
+
+            if (memcmp(Ptr, Expected, Avail) != 0) {
+                size_t i = 0;
+                while (Ptr[i] == Expected[i]) ++i;
+                mMismatch = mPos + i;
+            }
+        }
+        mPos += Size;
+    }
+
+    virtual uint64_t current_pos() const { return mPos; }
+
+    StringRef   mExpected;
+    uint64_t    mPos;
+    uint64_t    mMismatch;
+};
+
+// Output stream used for --only-if-changed.  The bytes are compared against
+// the existing output file as they are produced; only once they diverge is a
+// temporary file created, seeded with the matching prefix from the old file,
+// and written from then on.  commit() renames the temporary file over the
+// output, or leaves the output untouched (modification time included) if the
+// contents did not change.
+class UpdatingOstream : public ComparingOstream {
+public:
+    UpdatingOstream(StringRef Expected, StringRef Filename)
+        : ComparingOstream(Expected)
+        , mFilename(Filename)
+        , mFailed(false)
     {
-        uint64_t LastBaseAddr = UINT64_MAX;
+    }
+    virtual ~UpdatingOstream() {
+        flush();
+        if (mOut) {
+            mOut->clear_error();
+            mOut.reset();
+            sys::fs::remove(mTempPath.str());
+        }
+    }
 
-        Out.os() << "; Contents of section " << SectionName << "(@" << format("%08" PRIx64, SectionAddress) << "):\n";
+    bool commit() {
+        flush();
+        if (mFailed) return false;
 
-        // Dump out content as Intel-Hex.
-        uint64_t addr;
-        uint64_t end;
-        for (addr = 0, end = SectionContents.size(); addr < end; addr += 16) {
-            uint64_t      LineAddr = SectionAddress + addr;
-            uint64_t      Base = LineAddr >> 16;
-            uint64_t      Size = (addr + 16 > end) ? end-addr : 16;
-            unsigned char Sum;
+        if (!mOut) {
+            if (mPos == mExpected.size()) return true;
+            // The new output is a strict prefix of the old one.
+            if (!diverge(mPos)) return false;
+        }
 
-            if (LastBaseAddr != Base) {
-                Sum = 6 + (Base & 0xff) + ((Base >> 8) & 0xff);
-                Out.os() << format(":02000004%04" PRIx64 "%02" PRIx8 "\n", Base, (unsigned char)(-Sum));
-                LastBaseAddr = Base;
-            }
+        mOut->close();
+        if (mOut->has_error()) {
+            errs() << ToolName << ": '" << mTempPath.str() << "': error writing file.\n";
+            return false;
+        }
+        mOut.reset();
 
-            // Dump line header.
-            Sum = Size + (LineAddr & 0xff) + ((LineAddr >> 8) & 0xff);
-            Out.os() << format(":%02" PRIx64 "%04" PRIx64 "00", Size, LineAddr & 0xffff);
+        if (error_code ec = sys::fs::rename(mTempPath.str(), mFilename)) {
+            errs() << ToolName << ": '" << mFilename << "': " << ec.message() << ".\n";
+            sys::fs::remove(mTempPath.str());
+            return false;
+        }
+        return true;
+    }
 
-            // Dump line of hex.
-            for (uint64_t i = 0; i < Size; ++i) {
-                Sum += SectionContents[addr + i];
-                Out.os() << format("%02" PRIx8, (unsigned char)(SectionContents[addr + i]));
-            }
-            // Dump checksum byte.
-            Out.os() << format("%02" PRIx8 "\n", (unsigned char)(-Sum));
+private:
+    virtual void write_impl(const char *Ptr, size_t Size) {
+        if (mFailed) return;
+
+        if (!mOut) {
+            uint64_t Start = mPos;
+            ComparingOstream::write_impl(Ptr, Size);
+            if (mMismatch == UINT64_MAX && mPos <= mExpected.size()) return;
+            if (!diverge(Start)) return;
+        }
+        mOut->write(Ptr, Size);
+    }
+
+    // Switch from comparing to writing: create the temporary file and copy the
+    // first Prefix bytes, which are known to be unchanged, from the old file.
+    bool diverge(uint64_t Prefix) {
+        int FD;
+        if (error_code ec = sys::fs::createUniqueFile(mFilename + "-%%%%%%", FD, mTempPath)) {
+            errs() << ToolName << ": '" << mFilename << "': " << ec.message() << ".\n";
+            mFailed = true;
+            return false;
         }
+#ifdef LLVM_ON_UNIX
+        // The file renamed over the output keeps the output's permissions.
+        struct stat Status;
+        if (::stat(mFilename.c_str(), &Status) == 0) ::fchmod(FD, Status.st_mode & 07777);
+#endif
+        mOut.reset(new raw_fd_ostream(FD, true));
+        if (OutputBufferSize) mOut->SetBufferSize(OutputBufferSize);
+        mOut->write(mExpected.data(), Prefix);
+        return true;
     }
+
+    std::string                 mFilename;
+    SmallString<128>            mTempPath;
+    OwningPtr<raw_fd_ostream>   mOut;
+    bool                        mFailed;
 };
 
-class ObjectCopyReadMemH : public ObjectCopyBase {
+#ifdef O_DIRECT
+// Output stream used for --direct-io.  Data is staged in buffers aligned for
+// O_DIRECT and written in whole blocks, bypassing the page cache.  O_DIRECT
+// writes do not return until the data is on the device, so they are issued
+// from a write-behind thread: the buffer is split in two halves, and while
+// one is being written the other is filled.  The alignment is the logical
+// block size of the device, or the block size of the file system the output
+// is on.  The final partial block is padded with zeros for the write and the
+// file is then truncated back to its real length.
+class DirectFdOstream : public raw_ostream {
 public:
-    ObjectCopyReadMemH(StringRef InputFilename) 
-        : ObjectCopyBase(InputFilename) {}
-    virtual ~ObjectCopyReadMemH() {}
-
-protected:
-    virtual void PrintSection(tool_output_file &Out, const StringRef &SectionName,
-                              const StringRef &SectionContents, uint64_t SectionAddress) const
+    DirectFdOstream(size_t BufferSize)
+        : mFD(-1)
+        , mAlignment(4096)
+        , mBufferSize(std::max<size_t>(BufferSize / 2, 1))
+        , mFill(0)
+        , mUsed(0)
+        , mPos(0)
+        , mPending(0)
+        , mStop(false)
+        , mError(0)
+        , mKeep(false)
     {
-        // Dump address
-        Out.os() << "@" << format("%" PRIx64, SectionAddress) << "\n";
-        uint64_t addr;
-        uint64_t end;
-        for (addr = 0, end = SectionContents.size(); addr < end; ++addr) {
-            // Dump hex value.
-            Out.os() << format("%02" PRIx8 "\n", (unsigned char)(SectionContents[addr]));
+        mBuffers[0] = mBuffers[1] = NULL;
+    }
+    virtual ~DirectFdOstream() {
+        flush();
+        stopWriter();
+        if (mFD >= 0) ::close(mFD);
+        if (!mKeep && !mFilename.empty()) sys::fs::remove(mFilename);
+        free(mBuffers[0]);
+        free(mBuffers[1]);
+    }
+
+    bool open(StringRef Filename) {
+        mFD = ::open(Filename.str().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+        if (mFD < 0) {
+            errs() << ToolName << ": '" << Filename << "': " << strerror(errno) << ".\n";
+            return false;
+        }
+        mFilename = Filename;
+
+        struct stat Status;
+        if (::fstat(mFD, &Status) == 0) {
+#ifdef BLKSSZGET
+            int SectorSize;
+            if (S_ISBLK(Status.st_mode) && ::ioctl(mFD, BLKSSZGET, &SectorSize) == 0) {
+                Status.st_blksize = SectorSize;
+            }
+#endif
+            if (Status.st_blksize >= 512 && isPowerOf2_64(Status.st_blksize)) mAlignment = Status.st_blksize;
+        }
+        mBufferSize = RoundUpToAlignment(mBufferSize, mAlignment);
+
+        for (unsigned i = 0; i != 2; ++i) {
+            if (posix_memalign(reinterpret_cast<void **>(&mBuffers[i]), mAlignment, mBufferSize) != 0) {
+                mBuffers[i] = NULL;
+                errs() << ToolName << ": cannot allocate a " << mBufferSize << " byte output buffer\n";
+                return false;
+            }
+        }
+
+        mWriter = std::thread([this]() { writeBehind(); });
+        return true;
+    }
+
+    bool commit() {
+        flush();
+        if (mUsed != 0) {
+            size_t Padded = RoundUpToAlignment(mUsed, mAlignment);
+            memset(mBuffers[mFill] + mUsed, 0, Padded - mUsed);
+            post(Padded);
+        }
+        stopWriter();
+        if (!mError && ::ftruncate(mFD, mPos) != 0) mError = errno;
+        if (::close(mFD) != 0 && !mError) mError = errno;
+        mFD = -1;
+
+        if (mError) {
+            errs() << ToolName << ": '" << mFilename << "': " << strerror(mError) << ".\n";
+            return false;
+        }
+        mKeep = true;
+        return true;
+    }
+
+private:
+    virtual void write_impl(const char *Ptr, size_t Size) {
+        mPos += Size;
+        while (Size != 0) {
+            size_t N = std::min(Size, mBufferSize - mUsed);
+            memcpy(mBuffers[mFill] + mUsed, Ptr, N);
+            mUsed += N;
+            Ptr   += N;
+            Size  -= N;
+            if (mUsed == mBufferSize) post(mUsed);
+        }
+    }
+
+    virtual uint64_t current_pos() const { return mPos; }
+
+    // Hand the buffer being filled to the writer, once it has finished with
+    // the other one, and go on filling that.
+    void post(size_t Size) {
+        std::unique_lock<std::mutex> Lock(mLock);
+        mIdle.wait(Lock, [this]() { return mPending == 0; });
+        mPending = Size;
+        mReady.notify_one();
+        mFill = 1 - mFill;
+        mUsed = 0;
+    }
+
+    void stopWriter() {
+        if (!mWriter.joinable()) return;
+        {
+            std::lock_guard<std::mutex> Lock(mLock);
+            mStop = true;
+        }
+        mReady.notify_one();
+        mWriter.join();
+    }
+
+    // Body of the write-behind thread.  Buffers are posted alternately, so
+    // the one to write is always the other one from the last.
+    void writeBehind() {
+        unsigned Next = 0;
+        std::unique_lock<std::mutex> Lock(mLock);
+        for (;;) {
+            mReady.wait(Lock, [this]() { return mPending != 0 || mStop; });
+            if (mPending == 0) return;
+
+            size_t Size = mPending;
+            Lock.unlock();
+            const char *Ptr   = mBuffers[Next];
+            int         Error = 0;
+            while (Size != 0 && !Error && !mError) {
+                ssize_t Written = ::write(mFD, Ptr, Size);
+                if (Written < 0) {
+                    if (errno != EINTR) Error = errno;
+                    continue;
+                }
+                Ptr  += Written;
+                Size -= Written;
+            }
+            Next = 1 - Next;
+            Lock.lock();
+
+            if (Error && !mError) mError = Error;
+            mPending = 0;
+            mIdle.notify_one();
         }
     }
+
+    int                     mFD;
+    std::string             mFilename;
+    size_t                  mAlignment;
+    char                   *mBuffers[2];
+    size_t                  mBufferSize;
+    unsigned                mFill;          // The buffer being filled.
+    size_t                  mUsed;
+    uint64_t                mPos;
+
+    // Shared with the writer.  mPending is the size of the buffer it has
+    // been handed, zero while it has none.
+    std::thread             mWriter;
+    std::mutex              mLock;
+    std::condition_variable mReady;
+    std::condition_variable mIdle;
+    size_t                  mPending;
+    bool                    mStop;
+    std::atomic<int>        mError;
+    bool                    mKeep;
 };
+#endif
 
-class ObjectCopyBinary : public ObjectCopyBase {
+// Output stream used for -O binary_lz4.  The data is cut into blocks of
+// --compress-block-size bytes, which are compressed independently, a batch
+// at a time on the --threads pool, and written in order.  A block that does
+// not shrink is stored as is.  finish() appends the block index, so that any
+// block can be located and expanded on its own:
+//
+//   "LOCB" <blocks> <index> <image size> <block size> <block count> "LOCB"
+//
+// The index has one 32-bit entry per block: its size in the file, with bit 31
+// set if it is stored uncompressed.  The image size is 64 bits and the block
+// size and count 32 bits.  All numbers are little-endian.
+class BlockCompressingOstream : public raw_ostream {
 public:
-    ObjectCopyBinary(StringRef InputFilename) 
-        : ObjectCopyBase(InputFilename)
+    BlockCompressingOstream(raw_ostream &Out, size_t BlockSize)
+        : mOut(Out)
+        , mBlockSize(BlockSize)
+        , mPos(0)
+        , mBatch(Buffers.acquire())
     {
-        mBinaryOutput = true;
-        mFillGaps     = true;
+        unsigned NumThreads = Threads ? unsigned(Threads) : std::thread::hardware_concurrency();
+        mBatchSize = std::max(1u, NumThreads) * BlockSize;
+        // A batch and its compressed copy take up to three blocks per block.
+        if (BatchMemory != 0) {
+            mBatchSize = std::min<uint64_t>(mBatchSize, std::max<uint64_t>(1, BatchMemory / (3 * BlockSize)) * BlockSize);
+        }
+        mOut << "LOCB";
+    }
+    virtual ~BlockCompressingOstream() {
+        flush();
+        Buffers.release(mBatch);
     }
-    virtual ~ObjectCopyBinary() {}
 
-protected:
-    virtual void PrintSection(tool_output_file &Out, const StringRef &SectionName,
-                              const StringRef &SectionContents, uint64_t SectionAddress) const
-    {
-        uint64_t addr;
-        uint64_t end;
-        for (addr = 0, end = SectionContents.size(); addr < end; ++addr) {
-            Out.os() << SectionContents[addr];
+    void finish() {
+        flush();
+        compressBatch();
+
+        for (size_t i = 0, e = mIndex.size(); i != e; ++i) {
+            WriteLE(mIndex[i], 4);
         }
+        WriteLE(mPos, 8);
+        WriteLE(mBlockSize, 4);
+        WriteLE(mIndex.size(), 4);
+        mOut << "LOCB";
     }
 
-    virtual void FillGap(tool_output_file &Out, unsigned char Value, uint64_t Size) const
-    {
-        uint64_t i;
-        for (i = 0; i < Size; ++i) {
-            Out.os() << Value;
+private:
+    virtual void write_impl(const char *Ptr, size_t Size) {
+        mPos += Size;
+        while (Size != 0) {
+            size_t N = std::min(Size, mBatchSize - mBatch->size());
+            mBatch->append(Ptr, N);
+            Ptr  += N;
+            Size -= N;
+            if (mBatch->size() == mBatchSize) compressBatch();
         }
     }
-};
 
-int main(int argc, char **argv) {
-    // Print a stack trace if we signal out.
-    sys::PrintStackTraceOnErrorSignal();
-    PrettyStackTraceProgram X(argc, argv);
-    llvm_shutdown_obj Y;  // Call llvm_shutdown() on exit.
+    virtual uint64_t current_pos() const {
+        return mPos;
+    }
 
-    cl::ParseCommandLineOptions(argc, argv, "llvm object file copy utility\n");
+    void compressBatch() {
+        size_t NumBlocks = (mBatch->size() + mBlockSize - 1) / mBlockSize;
+        mCompressed.resize(NumBlocks);
 
-    ToolName = argv[0];
-    OwningPtr<ObjectCopyBase> ObjectCopy;
+        ParallelFor(NumBlocks, [&](size_t i) {
+            std::string *Scratch = Buffers.acquire();
+            mCompressed[i] = Buffers.acquire();
+            compressLZ4Block(StringRef(*mBatch).substr(i * mBlockSize, mBlockSize), *mCompressed[i], *Scratch);
+            Buffers.release(Scratch);
+            return true;
+        });
 
-    switch (OutputTarget) {
-    case OutputFormatTy::binary:
-        ObjectCopy.reset(new ObjectCopyBinary(InputFilename));
-        break;
-    case OutputFormatTy::intel_hex:
-        ObjectCopy.reset(new ObjectCopyIntelHex(InputFilename));
-        break;
-    case OutputFormatTy::readmemh:
-        ObjectCopy.reset(new ObjectCopyReadMemH(InputFilename));
-        break;
-    default:
-        return 1;
+        for (size_t i = 0; i != NumBlocks; ++i) {
+            StringRef          Block      = StringRef(*mBatch).substr(i * mBlockSize, mBlockSize);
+            const std::string &Compressed = *mCompressed[i];
+            if (Compressed.size() < Block.size()) {
+                mOut << Compressed;
+                mIndex.push_back(Compressed.size());
+            } else {
+                mOut << Block;
+                mIndex.push_back(Block.size() | 0x80000000);
+            }
+            Buffers.release(mCompressed[i]);
+        }
+        mBatch->clear();
     }
 
-    // If file isn't stdin, check that it exists.
-    if (InputFilename != "-" && !sys::fs::exists(InputFilename)) {
-        errs() << ToolName << ": '" << InputFilename << "': " << "No such file\n";
-        return 1;
+    void WriteLE(uint64_t Value, unsigned Bytes) {
+        for (unsigned i = 0; i != Bytes; ++i) {
+            mOut << char(Value >> (8 * i));
+        }
     }
 
-    // Attempt to open  binary.
-    OwningPtr<Binary> binary;
-    if (error_code ec = createBinary(InputFilename, binary)) {
-        errs() << ToolName << ": '" << InputFilename << "': " << ec.message() << ".\n";
-        return 1;
+    raw_ostream            &mOut;
+    size_t                  mBlockSize;
+    size_t                  mBatchSize;
+    uint64_t                mPos;
+    std::string            *mBatch;
+    std::vector<std::string *> mCompressed;
+    std::vector<uint32_t>   mIndex;
+};
+
+// Output stream used for c_array and asm output: formats the bytes written to
+// it as a comma separated list of hex constants, 16 bytes to a line, each line
+// started with Prefix.  Bytes are grouped into elements of Width bytes in
+// the byte order of the input, so the data has the same layout in memory as
+// the binary image.  The digits are looked up in a table rather than formatted.
+class SourceArrayOstream : public raw_ostream {
+public:
+    SourceArrayOstream(raw_ostream &Out, StringRef Prefix, StringRef Suffix,
+                       unsigned Width, bool BigEndian, bool CountOnly)
+        : mOut(Out)
+        , mPrefix(Prefix)
+        , mSuffix(Suffix)
+        , mWidth(Width)
+        , mBigEndian(BigEndian)
+        , mCountOnly(CountOnly)
+        , mPos(0)
+        , mPending(0)
+    {
+        static const char Digits[] = "0123456789abcdef";
+        for (unsigned i = 0; i != 256; ++i) {
+            mHex[i][0] = Digits[i >> 4];
+            mHex[i][1] = Digits[i & 15];
+        }
+    }
+    virtual ~SourceArrayOstream() {
+        flush();
     }
 
-    ObjectFile *o = dyn_cast<ObjectFile>(binary.get());
-    if (o == NULL) {
-        errs() << ToolName << ": '" << InputFilename << "': " << "Unrecognized file type.\n";
+    // Complete the last element, padding it with zeros, and the last line.
+    void finish() {
+        flush();
+        if (mPending % mWidth != 0) {
+            static const char Zeros[8] = { 0 };
+            write_impl(Zeros, mWidth - mPending % mWidth);
+        }
+        if (mPending != 0) formatLine(mLine, mPending);
     }
 
-    ObjectCopy->CopyTo(o, OutputFilename);
+    uint64_t elements() const { return (mPos + mWidth - 1) / mWidth; }
+
+private:
+    virtual void write_impl(const char *Ptr, size_t Size) {
+        mPos += Size;
+        if (mCountOnly) return;
+
+        while (Size != 0) {
+            if (mPending == 0 && Size >= sizeof(mLine)) {
+                formatLine(Ptr, sizeof(mLine));
+                Ptr  += sizeof(mLine);
+                Size -= sizeof(mLine);
+                continue;
+            }
+            size_t N = std::min(Size, sizeof(mLine) - mPending);
+            memcpy(mLine + mPending, Ptr, N);
+            mPending += N;
+            Ptr      += N;
+            Size     -= N;
+            if (mPending == sizeof(mLine)) formatLine(mLine, sizeof(mLine));
+        }
+    }
+
+    virtual uint64_t current_pos() const {
+        return mPos;
+    }
+
+    // Format Size bytes, a whole number of elements, as one line.
+    void formatLine(const char *Data, size_t Size) {
+        char   Text[16 * 4 + 64];
+        size_t Len = 0;
+        for (size_t i = 0; i < Size; i += mWidth) {
+            if (i != 0) Text[Len++] = ',';
+            Text[Len++] = '0';
+            Text[Len++] = 'x';
+            for (unsigned b = 0; b != mWidth; ++b) {
+                unsigned char Byte = Data[i + (mBigEndian ? b : mWidth - 1 - b)];
+                Text[Len++] = mHex[Byte][0];
+                Text[Len++] = mHex[Byte][1];
+            }
+        }
+        mOut << mPrefix;
+        mOut.write(Text, Len);
+        mOut << mSuffix;
+        mPending = 0;
+    }
+
+    raw_ostream    &mOut;
+    std::string     mPrefix;
+    std::string     mSuffix;
+    unsigned        mWidth;
+    bool            mBigEndian;
+    bool            mCountOnly;
+    uint64_t        mPos;
+    size_t          mPending;
+    char            mLine[16];
+    char            mHex[256][2];
+};
+
+// Length of the run of bytes equal to Value at the start of Data.  The bulk
+// of the scan compares a 64-bit word at a time.
+static size_t ErasedRunLength(StringRef Data, unsigned char Value) {
+    const uint64_t Pattern = UINT64_C(0x0101010101010101) * Value;
+    const char    *Ptr     = Data.data();
+    size_t         Size    = Data.size();
+    size_t         i       = 0;
+
+    for (; i + 8 <= Size; i += 8) {
+        uint64_t Word;
+        memcpy(&Word, Ptr + i, sizeof(Word));
+        if (Word != Pattern) break;
+    }
+    while (i < Size && (unsigned char)Ptr[i] == Value) ++i;
+    return i;
+}
+
+// Length of the run of bytes equal to Value at the end of Data.
+static size_t ErasedTailLength(StringRef Data, unsigned char Value) {
+    const uint64_t Pattern = UINT64_C(0x0101010101010101) * Value;
+    const char    *Ptr     = Data.data();
+    size_t         i       = Data.size();
+
+    for (; i >= 8; i -= 8) {
+        uint64_t Word;
+        memcpy(&Word, Ptr + i - 8, sizeof(Word));
+        if (Word != Pattern) break;
+    }
+    while (i > 0 && (unsigned char)Ptr[i - 1] == Value) --i;
+    return Data.size() - i;
+}
+
+// A section selected for copying, already cropped to the requested address
+// ranges.  Contents points into the input file's mapping.
+struct SectionData {
+    StringRef Name;
+    StringRef Contents;
+    uint64_t  Address;
+};
+
+static bool CompareAddress(const SectionData &A, const SectionData &B) {
+    return A.Address < B.Address;
+}
+
+// The mappings of the input files.  Inputs are mapped here rather than by
+// MemoryBuffer so the kernel can be told how they are read: in order, with
+// the sections about to be written read ahead, and, when every section is
+// written only once, with the pages of sections already written dropped.
+// Anything that is not a regular file is read as before.
+class InputMappings {
+public:
+    InputMappings() : mReleaseConsumed(false) {}
+    ~InputMappings() {
+#ifdef LLVM_ON_UNIX
+        for (size_t i = 0, e = mMappings.size(); i != e; ++i) {
+            ::munmap(const_cast<char *>(mMappings[i].data()), mMappings[i].size());
+        }
+#endif
+    }
+
+    // Open Filename as a binary.  The mapping outlives the binary, until the
+    // end of the run.  Safe to call concurrently.
+    error_code open(StringRef Filename, OwningPtr<Binary> &Result) {
+#ifdef LLVM_ON_UNIX
+        int FD = Filename == "-" ? -1 : ::open(Filename.str().c_str(), O_RDONLY);
+        struct stat Stat;
+        if (FD >= 0 && ::fstat(FD, &Stat) == 0 && S_ISREG(Stat.st_mode) && Stat.st_size != 0) {
+            int Flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+            if (PopulateInput) Flags |= MAP_POPULATE;
+#endif
+            void *Data = ::mmap(NULL, Stat.st_size, PROT_READ, Flags, FD, 0);
+            ::close(FD);
+            if (Data == MAP_FAILED) return error_code(errno, system_category());
+
+            ::madvise(Data, Stat.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+            if (HugePageInput) ::madvise(Data, Stat.st_size, MADV_HUGEPAGE);
+#endif
+            StringRef Contents(static_cast<const char *>(Data), Stat.st_size);
+            {
+                std::lock_guard<std::mutex> Lock(mLock);
+                mMappings.push_back(Contents);
+            }
+            return createBinary(MemoryBuffer::getMemBuffer(Contents, Filename, false), Result);
+        }
+        if (FD >= 0) ::close(FD);
+#endif
+        return createBinary(Filename, Result);
+    }
+
+    // Drop the pages of sections once written, instead of leaving them to
+    // the page cache to reclaim.
+    void setReleaseConsumed(bool Release) { mReleaseConsumed = Release; }
+
+    // Start reading in Data, if it is part of an input mapping.
+    void willNeed(StringRef Data) const {
+#ifdef LLVM_ON_UNIX
+        advise(Data, MADV_WILLNEED, false);
+#endif
+    }
+
+    // Data, if it is part of an input mapping, will not be read again.  Pages
+    // it shares with its neighbours are kept.
+    void consumed(StringRef Data) const {
+#ifdef LLVM_ON_UNIX
+        if (mReleaseConsumed) advise(Data, MADV_DONTNEED, true);
+#endif
+    }
+
+private:
+#ifdef LLVM_ON_UNIX
+    void advise(StringRef Data, int Advice, bool WholePagesOnly) const {
+        static const uintptr_t PageSize = ::getpagesize();
+
+        for (size_t i = 0, e = mMappings.size(); i != e; ++i) {
+            StringRef Mapping = mMappings[i];
+            if (Data.begin() < Mapping.begin() || Data.end() > Mapping.end()) continue;
+
+            uintptr_t Begin = reinterpret_cast<uintptr_t>(Data.begin());
+            uintptr_t End   = reinterpret_cast<uintptr_t>(Data.end());
+            if (WholePagesOnly) {
+                Begin = RoundUpToAlignment(Begin, PageSize);
+                End   = End & ~(PageSize - 1);
+                // The last page of a mapping has no neighbour after it.
+                if (Data.end() == Mapping.end()) End = RoundUpToAlignment(End, PageSize);
+            } else {
+                Begin = Begin & ~(PageSize - 1);
+            }
+            if (Begin < End) ::madvise(reinterpret_cast<void *>(Begin), End - Begin, Advice);
+            return;
+        }
+    }
+#endif
+
+    std::mutex              mLock;
+    std::vector<StringRef>  mMappings;
+    bool                    mReleaseConsumed;
+};
+
+static InputMappings Mappings;
+
+// How far SectionReadahead reads ahead of the section being written.
+static uint64_t ReadaheadWindow = 8 << 20;
+
+// Keeps the input read ahead of the section being written, by up to
+// ReadaheadWindow bytes of the sections that follow it.
+class SectionReadahead {
+public:
+    SectionReadahead(ArrayRef<SectionData> Sections)
+        : mSections(Sections)
+        , mNext(0)
+        , mQueued(0)
+    {
+    }
+
+    // Called before section i is written.
+    void advance(size_t i) {
+        if (i != 0) mQueued -= mSections[i - 1].Contents.size();
+        while (mNext < mSections.size() && (mNext <= i || mQueued < ReadaheadWindow)) {
+            Mappings.willNeed(mSections[mNext].Contents);
+            mQueued += mSections[mNext].Contents.size();
+            ++mNext;
+        }
+    }
+
+private:
+    ArrayRef<SectionData>   mSections;
+    size_t                  mNext;      // Sections before this one are queued.
+    uint64_t                mQueued;    // Bytes queued from the current section on.
+};
+
+// Decompressed copies of compressed input sections.  SectionData refers to
+// them for the rest of the run.  Inputs are collected concurrently, hence the
+// lock.
+class DecompressedBuffers {
+public:
+    DecompressedBuffers() : mReserved(0) {}
+    ~DecompressedBuffers() { DeleteContainerPointers(mBuffers); }
+
+    // Account for Size more bytes of inflated data.  Returns false if that
+    // would take the total past the part of --memory-limit for it.
+    bool reserve(uint64_t Size) {
+        std::lock_guard<std::mutex> Lock(mLock);
+        if (MemoryBudget != 0 && Size > InflateMemory - mReserved) return false;
+        mReserved += Size;
+        return true;
+    }
+
+    uint64_t reserved() {
+        std::lock_guard<std::mutex> Lock(mLock);
+        return mReserved;
+    }
+
+    StringRef add(MemoryBuffer *Buffer) {
+        std::lock_guard<std::mutex> Lock(mLock);
+        mBuffers.push_back(Buffer);
+        return Buffer->getBuffer();
+    }
+
+private:
+    std::mutex                  mLock;
+    std::vector<MemoryBuffer *> mBuffers;
+    uint64_t                    mReserved;
+};
+
+static DecompressedBuffers Decompressed;
+
+// A selected section that has to be inflated before it can be copied.
+struct PendingSection {
+    size_t                          Index;      // Into the collected sections.
+    SectionDecompressor::Compressed Section;
+    uint64_t                        Offset;     // Part selected by --address-range.
+    uint64_t                        Size;
+};
+
+// Inflate the compressed sections that were selected for copying, in
+// parallel, and point their SectionData at the result.  A section split by
+// --address-range has consecutive entries, and is only inflated once.
+static bool DecompressSections(ArrayRef<PendingSection> Pending, std::vector<SectionData> &Sections) {
+    std::vector<size_t> Unique;
+    for (size_t i = 0, e = Pending.size(); i != e; ++i) {
+        if (i == 0 || Pending[i].Section.Stream.data() != Pending[i - 1].Section.Stream.data()) Unique.push_back(i);
+    }
+    std::vector<MemoryBuffer *> Results(Unique.size());
+
+    // Inflated sections stay in memory until the end of the run.
+    uint64_t Total = 0;
+    for (size_t i = 0, e = Unique.size(); i != e; ++i) {
+        Total += Pending[Unique[i]].Section.Size;
+    }
+    if (!Decompressed.reserve(Total)) {
+        errs() << ToolName << ": inflating the compressed sections of the input takes " << Total
+               << " bytes, more than --memory-limit allows\n";
+        return false;
+    }
+
+    bool Success = ParallelFor(Unique.size(), [&](size_t i) {
+        const PendingSection   &P = Pending[Unique[i]];
+        OwningPtr<MemoryBuffer> Result;
+        if (!SectionDecompressor::decompress(Sections[P.Index].Name, P.Section, Result)) return false;
+        Results[i] = Result.take();
+        return true;
+    });
+    if (!Success) {
+        DeleteContainerPointers(Results);
+        return false;
+    }
+
+    StringRef Data;
+    for (size_t i = 0, u = 0, e = Pending.size(); i != e; ++i) {
+        if (u != Unique.size() && Unique[u] == i) Data = Decompressed.add(Results[u++]);
+        Sections[Pending[i].Index].Contents = Data.substr(Pending[i].Offset, Pending[i].Size);
+    }
+    return true;
+}
+
+// Zero bytes for the parts of sections that the file has no data for.  Every
+// request is served from one calloc'd block, as large as the largest request
+// so far; calloc gets large blocks as fresh pages, which take no memory while
+// they are only read.  Smaller blocks are kept as SectionData may still refer
+// to them.
+class ZeroFill {
+public:
+    ZeroFill() : mSize(0) {}
+    ~ZeroFill() {
+        for (size_t i = 0, e = mBlocks.size(); i != e; ++i) free(mBlocks[i]);
+    }
+
+    bool get(uint64_t Size, StringRef &Zeros) {
+        std::lock_guard<std::mutex> Lock(mLock);
+        if (Size > mSize) {
+            void *Block = Size == size_t(Size) ? calloc(Size, 1) : NULL;
+            if (Block == NULL) return false;
+            mBlocks.push_back(Block);
+            mSize = Size;
+        }
+        Zeros = StringRef(static_cast<const char *>(mBlocks.back()), Size);
+        return true;
+    }
+
+private:
+    std::mutex          mLock;
+    std::vector<void *> mBlocks;
+    uint64_t            mSize;
+};
+
+static ZeroFill Zeros;
+
+// Collect a section of a PE image, at ImageBase plus its RVA.  The raw data
+// is used in place; the zeros between its end and VirtualSize follow as a
+// second part of the section.  Sections without raw data are left out, like
+// .bss in ELF files, as are discardable ones unless named by -j.
+static bool CollectPESection(const PEImage::Section *Header, StringRef Name, std::vector<SectionData> &Sections) {
+    if (   Header == NULL
+        || Header->Contents.empty()
+        || (Header->Discardable && !Filter.namesExplicitly(Name))) {
+        return true;
+    }
+
+    SectionFilter::AddressParts Parts;
+    Filter.selectAddress(Header->Address, Header->Size, Parts);
+    for (size_t i = 0, e = Parts.size(); i != e; ++i) {
+        uint64_t Begin = Parts[i].first;
+        uint64_t Size  = Parts[i].second;
+
+        SectionData Section;
+        Section.Name     = Name;
+        Section.Address  = Begin;
+        Section.Contents = Header->Contents.substr(Begin - Header->Address, Size);
+        if (!Section.Contents.empty()) Sections.push_back(Section);
+
+        uint64_t ZeroSize = Size - Section.Contents.size();
+        if (ZeroSize != 0) {
+            Section.Address += Section.Contents.size();
+            if (!Zeros.get(ZeroSize, Section.Contents)) {
+                errs() << ToolName << ": section " << Name << ": cannot allocate "
+                       << ZeroSize << " bytes of zero fill\n";
+                return false;
+            }
+            Sections.push_back(Section);
+        }
+    }
+    return true;
+}
+
+// Add a section that is to be copied, or the parts of it selected by
+// --address-range.  Compressed sections are queued on Pending, one entry per
+// part, to be inflated once all sections have been looked at.
+static void AddSection(StringRef Name, uint64_t Address, uint64_t Size, StringRef Contents,
+                       const SectionDecompressor &Compression, std::vector<SectionData> &Sections,
+                       std::vector<PendingSection> &Pending) {
+    SectionDecompressor::Compressed Compressed;
+    bool IsCompressed = Compression.isCompressed(Name, Contents, Compressed);
+    if (IsCompressed) Size = Compressed.Size;
+
+    SectionFilter::AddressParts Parts;
+    Filter.selectAddress(Address, Size, Parts);
+    for (size_t i = 0, e = Parts.size(); i != e; ++i) {
+        SectionData Section;
+        Section.Name    = Name;
+        Section.Address = Parts[i].first;
+
+        if (IsCompressed) {
+            PendingSection P;
+            P.Index   = Sections.size();
+            P.Section = Compressed;
+            P.Offset  = Parts[i].first - Address;
+            P.Size    = Parts[i].second;
+            Pending.push_back(P);
+        } else {
+            Section.Contents = Contents.substr(Parts[i].first - Address, Parts[i].second);
+            if (Section.Contents.size() == 0) continue;
+        }
+        Sections.push_back(Section);
+    }
+}
+
+// Walk the section headers of o once and collect the sections to be copied.
+// Every output is generated from this list, so the input is only parsed once
+// however many outputs are requested.  Compressed sections are inflated, but
+// only once they are known to be selected.
+static bool CollectSections(ObjectFile *o, std::vector<SectionData> &Sections) {
+    SectionDecompressor         Compression(o);
+    std::vector<PendingSection> Pending;
+
+    // ELF files are walked through the section header index, which for
+    // files with very many sections is much cheaper than section_iterator.
+    ELFSectionIndex Index(o);
+    if (Index.isValid()) {
+        for (size_t i = 1, e = Index.getNumSections(); i < e; ++i) {
+            if (Index.getSize(i) == 0 || Index.isNoBits(i)) continue;
+
+            StringRef Name = Index.getName(i);
+            if (!Filter.selectName(Name)) continue;
+            if (!Index.isAllocated(i) && !Filter.namesExplicitly(Name)) continue;
+
+            StringRef Contents;
+            if (!Index.getContents(i, Contents)) {
+                errs() << ToolName << ": section " << Name << " extends past the end of '"
+                       << o->getFileName() << "'\n";
+                return false;
+            }
+            AddSection(Name, Index.getAddress(i), Index.getSize(i), Contents, Compression, Sections, Pending);
+        }
+        return Pending.empty() || DecompressSections(Pending, Sections);
+    }
+
+    PEImage    Image(o);
+    error_code ec;
+    unsigned   ImageIndex = 0;
+
+    for (section_iterator si = o->begin_sections(), se = o->end_sections(); si != se; si.increment(ec), ++ImageIndex) {
+        if (error(ec)) return false;
+
+        StringRef SectionName;
+        StringRef SectionContents;
+        uint64_t  SectionAddress;
+        uint64_t  SectionSize;
+        bool      BSS;
+        bool      Required;
+
+        // Look at the cheap header fields first, so that the contents of
+        // sections which are not copied are never paged in.
+        if (error(si->getName(SectionName))) return false;
+        if (!Filter.selectName(SectionName)) continue;
+        if (Image.isImage()) {
+            if (!CollectPESection(Image.getSection(ImageIndex), SectionName, Sections)) return false;
+            continue;
+        }
+        if (error(si->getAddress(SectionAddress))) return false;
+        if (error(si->getSize(SectionSize))) return false;
+        if (error(si->isBSS(BSS))) continue;
+        if (error(si->isRequiredForExecution(Required))) continue;
+
+        if (   (!Required && !Filter.namesExplicitly(SectionName))
+            || BSS
+            || SectionSize == 0) {
+            continue;
+        }
+
+        if (error(si->getContents(SectionContents))) return false;
+        AddSection(SectionName, SectionAddress, SectionSize, SectionContents, Compression, Sections, Pending);
+    }
+
+    return Pending.empty() || DecompressSections(Pending, Sections);
+}
+
+// Parse a byte count with an optional K, M or G suffix.
+static bool ParseSize(StringRef Str, uint64_t &Size) {
+    uint64_t Scale = 1;
+    if (Str.endswith("K") || Str.endswith("k")) {
+        Scale = 1 << 10;
+        Str   = Str.drop_back();
+    } else if (Str.endswith("M") || Str.endswith("m")) {
+        Scale = 1 << 20;
+        Str   = Str.drop_back();
+    } else if (Str.endswith("G") || Str.endswith("g")) {
+        Scale = 1 << 30;
+        Str   = Str.drop_back();
+    }
+    if (Str.getAsInteger(0, Size) || Size > UINT64_MAX / Scale) return false;
+    Size *= Scale;
+    return true;
+}
+
+// Sector layout of a flash device, used by --flash-layout.  Sections that land
+// in flash are padded with the erase value out to the sector boundaries they
+// touch, so every sector in the output is either complete or absent, and the
+// list of touched sectors can be written out for the programmer.
+class FlashLayout {
+public:
+    FlashLayout() {}
+
+    bool empty() const { return mSectorStarts.empty(); }
+
+    // Parse "<base>:<size>x<count>[,<size>x<count>...]", for example
+    // "0x08000000:16Kx4,64K,128Kx7".
+    bool init(StringRef Spec, unsigned char EraseValue) {
+        std::pair<StringRef, StringRef> BaseAndSectors = Spec.split(':');
+        uint64_t Address;
+        if (BaseAndSectors.first.getAsInteger(0, Address) || BaseAndSectors.second.empty()) {
+            return invalid(Spec);
+        }
+
+        uint64_t   MaxSector = 0;
+        StringRef  Rest      = BaseAndSectors.second;
+        while (!Rest.empty()) {
+            std::pair<StringRef, StringRef> Group = Rest.split(',');
+
+            // The count follows the last 'x' that does not start a hex
+            // number, so that "0x4000x4" is four sectors of 0x4000 bytes.
+            StringRef Item = Group.first;
+            size_t    Sep  = StringRef::npos;
+            for (size_t i = Item.size(); i-- != 0; ) {
+                if (Item[i] != 'x') continue;
+                if (i >= 1 && Item[i - 1] == '0' && (i == 1 || Item[i - 2] == 'x')) continue;
+                Sep = i;
+                break;
+            }
+
+            uint64_t Size;
+            uint64_t Count = 1;
+            if (   !ParseSize(Item.substr(0, Sep), Size) || Size == 0
+                || (Sep != StringRef::npos && (Item.substr(Sep + 1).getAsInteger(0, Count) || Count == 0))) {
+                return invalid(Spec);
+            }
+            if (   Count > MaxSectors - mSectorStarts.size()
+                || Size > (UINT64_MAX - Address) / Count) {
+                errs() << ToolName << ": flash layout '" << Spec << "' has more than " << MaxSectors
+                       << " sectors or ends past the address space\n";
+                return false;
+            }
+            for (uint64_t i = 0; i != Count; ++i) {
+                mSectorStarts.push_back(Address);
+                Address += Size;
+            }
+            MaxSector = std::max(MaxSector, Size);
+            Rest = Group.second;
+        }
+        mSectorStarts.push_back(Address);
+
+        mErased.assign(MaxSector, char(EraseValue));
+        return true;
+    }
+
+    // Insert padding entries so that every flash sector touched by Sections
+    // is covered completely.  Sections must not overlap.
+    void pad(std::vector<SectionData> &Sections) const {
+        std::vector<SectionData> Padded;
+        std::stable_sort(Sections.begin(), Sections.end(), CompareAddress);
+
+        uint64_t Cursor    = 0;
+        uint64_t SectorEnd = 0;
+        for (size_t i = 0, e = Sections.size(); i != e; ++i) {
+            const SectionData &Section = Sections[i];
+            uint64_t           End     = Section.Address + Section.Contents.size();
+
+            if (Section.Address < SectorEnd) {
+                // Still inside the sector the previous section ended in.
+                addPadding(Padded, Cursor, Section.Address);
+            } else {
+                addPadding(Padded, Cursor, SectorEnd);
+                size_t Sector = findSector(Section.Address);
+                if (Sector != NoSector) addPadding(Padded, mSectorStarts[Sector], Section.Address);
+            }
+            Padded.push_back(Section);
+
+            size_t LastSector = findSector(End - 1);
+            Cursor    = End;
+            SectorEnd = LastSector != NoSector ? mSectorStarts[LastSector + 1] : End;
+        }
+        addPadding(Padded, Cursor, SectorEnd);
+
+        Sections.swap(Padded);
+    }
+
+    // Write one line per sector that contains data.
+    bool writeManifest(ArrayRef<SectionData> Sections, StringRef Filename) const {
+        std::string ErrorInfo;
+        tool_output_file Out(Filename.data(), ErrorInfo, sys::fs::F_None);
+        if (!ErrorInfo.empty()) {
+            errs() << ErrorInfo << '\n';
+            return false;
+        }
+
+        Out.os() << "# sector address size\n";
+        size_t LastSector = NoSector;
+        for (size_t i = 0, e = Sections.size(); i != e; ++i) {
+            uint64_t Begin = Sections[i].Address;
+            uint64_t End   = Begin + Sections[i].Contents.size();
+            size_t   First = findSector(Begin);
+            size_t   Last  = findSector(End - 1);
+            if (First == NoSector || Last == NoSector) continue;
+
+            for (size_t Sector = First; Sector <= Last; ++Sector) {
+                if (LastSector != NoSector && Sector <= LastSector) continue;
+                Out.os() << Sector << " " << format("0x%08" PRIx64, mSectorStarts[Sector]) << " "
+                         << format("0x%" PRIx64, mSectorStarts[Sector + 1] - mSectorStarts[Sector]) << "\n";
+                LastSector = Sector;
+            }
+        }
+
+        Out.keep();
+        return true;
+    }
+
+private:
+    static const size_t NoSector = ~size_t(0);
+
+    // Bound on the sectors of a layout; each takes an entry in mSectorStarts.
+    static const uint64_t MaxSectors = 1 << 20;
+
+    bool invalid(StringRef Spec) const {
+        errs() << ToolName << ": invalid flash layout '" << Spec << "'\n";
+        return false;
+    }
+
+    // Index of the sector containing Address, or NoSector if it is not in flash.
+    size_t findSector(uint64_t Address) const {
+        std::vector<uint64_t>::const_iterator I =
+            std::upper_bound(mSectorStarts.begin(), mSectorStarts.end(), Address);
+        if (I == mSectorStarts.begin() || I == mSectorStarts.end()) return NoSector;
+        return I - mSectorStarts.begin() - 1;
+    }
+
+    void addPadding(std::vector<SectionData> &Sections, uint64_t Begin, uint64_t End) const {
+        if (End <= Begin) return;
+
+        SectionData Padding;
+        Padding.Name     = "<sector padding>";
+        Padding.Contents = StringRef(mErased.data(), End - Begin);
+        Padding.Address  = Begin;
+        Sections.push_back(Padding);
+    }
+
+    // Start address of every sector, followed by the end of the last one.
+    std::vector<uint64_t>   mSectorStarts;
+    std::string             mErased;
+};
+
+// Where a writer placed the encoding of Data, which starts at Address, in its
+// output.  Used by --personalize to find the records a patch lands in.
+struct OutputRecord {
+    uint64_t  Address;
+    StringRef Data;
+    uint64_t  Offset;
+};
+
+class ObjectCopyBase {
+public:
+    ObjectCopyBase(StringRef InputFilename) 
+        : mBinaryOutput(false)
+        , mFillGaps(false)
+        , mTrimErased(false)
+        , mRecords(NULL)
+    {
+    }
+    virtual ~ObjectCopyBase() {}
+
+    virtual bool CopyTo(ArrayRef<SectionData> Sections, StringRef OutputFilename) const {
+        if (DirectIO) {
+#ifdef O_DIRECT
+            DirectFdOstream Out(OutputBufferSize);
+            if (!Out.open(OutputFilename)) return false;
+            if (!WriteSections(Sections, Out)) return false;
+            return Out.commit();
+#else
+            errs() << ToolName << ": --direct-io is not supported on this platform\n";
+            return false;
+#endif
+        }
+
+        std::string ErrorInfo;
+
+        tool_output_file Out(OutputFilename.data(), ErrorInfo, mBinaryOutput ? sys::fs::F_Binary : sys::fs::F_None);
+        if (!ErrorInfo.empty()) {
+            errs() << ErrorInfo << '\n';
+            return false;
+        }
+
+        if (OutputBufferSize) Out.os().SetBufferSize(OutputBufferSize);
+        if (!WriteSections(Sections, Out.os())) return false;
+
+        Out.keep();
+        return true;
+    }
+
+    // Generate the output and compare it against the existing contents of
+    // OutputFilename instead of writing it.
+    bool VerifyAgainst(ArrayRef<SectionData> Sections, StringRef OutputFilename) const {
+        OwningPtr<MemoryBuffer> Existing;
+        if (error_code ec = MemoryBuffer::getFile(OutputFilename, Existing, -1, false)) {
+            errs() << ToolName << ": '" << OutputFilename << "': " << ec.message() << ".\n";
+            return false;
+        }
+
+        ComparingOstream Cmp(Existing->getBuffer());
+        if (!WriteSections(Sections, Cmp)) return false;
+
+        if (Cmp.differs()) {
+            errs() << ToolName << ": '" << OutputFilename << "': differs from generated output at offset "
+                   << format("0x%" PRIx64, Cmp.firstDifference()) << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Generate the output, but only replace OutputFilename if the result
+    // differs from what it already contains.
+    bool UpdateIfChanged(ArrayRef<SectionData> Sections, StringRef OutputFilename) const {
+        if (!sys::fs::exists(OutputFilename)) {
+            return CopyTo(Sections, OutputFilename);
+        }
+
+        OwningPtr<MemoryBuffer> Existing;
+        if (error_code ec = MemoryBuffer::getFile(OutputFilename, Existing, -1, false)) {
+            errs() << ToolName << ": '" << OutputFilename << "': " << ec.message() << ".\n";
+            return false;
+        }
+
+        UpdatingOstream Upd(Existing->getBuffer(), OutputFilename);
+        if (!WriteSections(Sections, Upd)) return false;
+
+        return Upd.commit();
+    }
+
+    // Encode Sections into Image instead of a file.
+    bool Encode(ArrayRef<SectionData> Sections, std::string &Image) const {
+        raw_string_ostream OS(Image);
+        bool Success = WriteSections(Sections, OS);
+        OS.flush();
+        return Success;
+    }
+
+    // Encode Sections into Image, noting where every data record ends up.
+    bool EncodeTemplate(ArrayRef<SectionData> Sections, std::string &Image,
+                        std::vector<OutputRecord> &Records) const {
+        mRecords = &Records;
+        bool Success = Encode(Sections, Image);
+        mRecords = NULL;
+        return Success;
+    }
+
+    // Write a previously encoded image to OutputFilename as is.
+    bool WriteImage(StringRef Image, const std::string &OutputFilename) const {
+        std::string ErrorInfo;
+
+        tool_output_file Out(OutputFilename.c_str(), ErrorInfo, mBinaryOutput ? sys::fs::F_Binary : sys::fs::F_None);
+        if (!ErrorInfo.empty()) {
+            errs() << ErrorInfo << '\n';
+            return false;
+        }
+
+        Out.os() << Image;
+        Out.keep();
+        return true;
+    }
+
+    // Encode one data record.  Re-encoding a record with different data of
+    // the same size must produce exactly as many bytes as the original.
+    virtual void EncodeRecord(raw_ostream &OS, uint64_t Address, StringRef Data) const = 0;
+
+    // Overwrite the encoding of the bytes of Record starting at Offset with
+    // that of Bytes, directly in Image.  Returns false if the format cannot
+    // do that, and the whole record has to be encoded again.
+    virtual bool PatchRecord(std::string &Image, const OutputRecord &Record, uint64_t Offset,
+                             StringRef Bytes) const {
+        return false;
+    }
+
+
+protected:
+    void NoteRecord(raw_ostream &OS, uint64_t Address, StringRef Data) const {
+        if (mRecords == NULL) return;
+
+        OutputRecord Record;
+        Record.Address = Address;
+        Record.Data    = Data;
+        Record.Offset  = OS.tell();
+        mRecords->push_back(Record);
+    }
+
+    virtual bool WriteSections(ArrayRef<SectionData> Sections, raw_ostream &OS) const {
+        bool        FillNextGap = false;
+        uint64_t    LastAddress;
+        StringRef   LastSectionName;
+        size_t      e = Sections.size();
+
+        // Nothing after the last non-erased byte needs to be written.
+        if (mTrimErased && SkipErased) {
+            while (e != 0 && ErasedRunLength(Sections[e - 1].Contents, GapFill) == Sections[e - 1].Contents.size()) {
+                --e;
+            }
+        }
+
+        SectionReadahead Readahead(Sections.slice(0, e));
+        for (size_t i = 0; i != e; ++i) {
+            const SectionData &Section  = Sections[i];
+            StringRef          Contents = Section.Contents;
+
+            Readahead.advance(i);
+
+            if (mTrimErased && SkipErased && i == e - 1) {
+                Contents = Contents.substr(0, Contents.size() - ErasedTailLength(Contents, GapFill));
+            }
+
+            if (FillNextGap) {
+                if (Section.Address < LastAddress) {
+                    errs() << "Trying to fill gaps between sections " << LastSectionName << " and " << Section.Name << " in invalid order\n";
+                    return false;
+                } else if (Section.Address == LastAddress) {
+                    // No gap, do nothing
+                } else if (Section.Address - LastAddress > (1<<16)) {
+                    // Gap size limit reached
+                    errs() << "Gap between sections is too large\n";
+                    return false;
+                } else {
+                    FillGap(OS, GapFill, Section.Address - LastAddress);
+                }
+            }
+
+            PrintSection(OS, Section.Name, Contents, Section.Address);
+            Mappings.consumed(Section.Contents);
+
+            if (mFillGaps) {
+                FillNextGap     = true;
+                LastSectionName = Section.Name;
+                LastAddress     = Section.Address + Contents.size();
+            }
+        }
+
+        return true;
+    }
+
+    virtual void PrintSection(raw_ostream &OS, const StringRef &SectionName,
+                              const StringRef &SectionContents, uint64_t SectionAddress) const = 0;
+    virtual void FillGap(raw_ostream &OS, unsigned char Value, uint64_t Size) const { }
+
+    bool                  mBinaryOutput;
+    bool                  mFillGaps;
+    bool                  mTrimErased;
+
+    mutable std::vector<OutputRecord> *mRecords;
+};
+
+// Number of hex digits printf's %0<Min>x prints for Value.
+static unsigned HexDigits(uint64_t Value, unsigned Min) {
+    unsigned Digits = 1;
+    while (Value >>= 4) ++Digits;
+    return std::max(Digits, Min);
+}
+
+// A piece of Intel Hex output: the records for bytes [Begin, End) of a
+// section, preceded by the section comment if Begin is zero, and where in
+// the output file they go.
+struct HexPiece {
+    size_t   Section;
+    uint64_t Begin;
+    uint64_t End;
+    uint64_t LastBase;  // Extended linear address in effect before the piece.
+    uint64_t Erased;    // Start of the erased end of the section.
+    uint64_t Offset;
+    uint64_t Size;
+};
+
+class ObjectCopyIntelHex : public ObjectCopyBase {
+public:
+    ObjectCopyIntelHex(StringRef InputFilename) 
+        : ObjectCopyBase(InputFilename) {}
+    virtual ~ObjectCopyIntelHex() {}
+
+    // Every section starts afresh, so given the section addresses and sizes
+    // the size of the output, and of every part of it, is known before
+    // anything is encoded.  With more than one thread the output is cut into
+    // pieces, which are encoded concurrently and written straight to their
+    // place in the file.
+    virtual bool CopyTo(ArrayRef<SectionData> Sections, StringRef OutputFilename) const {
+#ifdef LLVM_ON_UNIX
+        unsigned NumThreads = Threads ? unsigned(Threads) : std::thread::hardware_concurrency();
+        if (!DirectIO && NumThreads > 1 && OutputFilename != "-") {
+            return WritePieces(Sections, OutputFilename);
+        }
+#endif
+        return ObjectCopyBase::CopyTo(Sections, OutputFilename);
+    }
+
+protected:
+    virtual void PrintSection(raw_ostream &OS, const StringRef &SectionName,
+                              const StringRef &SectionContents, uint64_t SectionAddress) const
+    {
+        uint64_t LastBaseAddr = UINT64_MAX;
+
+        PrintHeader(OS, SectionName, SectionAddress);
+        PrintLines(OS, SectionContents, SectionAddress, 0, SectionContents.size(), ErasedFrom(SectionContents),
+                   LastBaseAddr);
+    }
+
+    virtual void EncodeRecord(raw_ostream &OS, uint64_t LineAddr, StringRef Data) const
+    {
+        uint64_t      Size = Data.size();
+        unsigned char Sum;
+
+        // Dump line header.
+        Sum = Size + (LineAddr & 0xff) + ((LineAddr >> 8) & 0xff);
+        OS << format(":%02" PRIx64 "%04" PRIx64 "00", Size, LineAddr & 0xffff);
+
+        // Dump line of hex.
+        for (uint64_t i = 0; i < Size; ++i) {
+            Sum += Data[i];
+            OS << format("%02" PRIx8, (unsigned char)(Data[i]));
+        }
+        // Dump checksum byte.
+        OS << format("%02" PRIx8 "\n", (unsigned char)(-Sum));
+    }
+
+private:
+    // Call Line(Offset, Size, Base, NewBase) for the data records of bytes
+    // [Begin, End) of a section at Address, in order.  Records start every
+    // 16 bytes from the start of the section, and so must Begin.  NewBase is
+    // true if Base differs from LastBase, the extended linear address in
+    // effect, and an extended linear address record is needed first.
+    // Erased is where the run of erased bytes ending the section starts (see
+    // ErasedFrom); nothing from there on is written.
+    template <typename LineFn>
+    static void ForEachLine(StringRef Contents, uint64_t Address, uint64_t Begin, uint64_t End,
+                            uint64_t Erased, uint64_t &LastBase, LineFn Line) {
+        uint64_t Size = Contents.size();
+        for (uint64_t addr = Begin; addr < End; addr += 16) {
+            if (SkipErased) {
+                // Skip whole lines that only contain the erase value.  A
+                // partial last line is skipped too if it is fully erased.
+                // The scan stops at the end of the piece, so that pieces
+                // cutting up a long erased run do not each scan all of it.
+                if (addr >= Erased) break;
+                uint64_t Run = ErasedRunLength(Contents.slice(addr, End), GapFill);
+                addr += Run & ~uint64_t(15);
+                if (addr >= End) break;
+            }
+
+            uint64_t Base = (Address + addr) >> 16;
+            Line(addr, std::min<uint64_t>(Size - addr, 16), Base, Base != LastBase);
+            LastBase = Base;
+        }
+    }
+
+    // Start of the run of erased bytes that ends Contents, found once per
+    // section; its size without --skip-erased.
+    static uint64_t ErasedFrom(StringRef Contents) {
+        if (!SkipErased) return Contents.size();
+        return Contents.size() - ErasedTailLength(Contents, GapFill);
+    }
+
+    static void PrintHeader(raw_ostream &OS, StringRef SectionName, uint64_t SectionAddress) {
+        OS << "; Contents of section " << SectionName << "(@" << format("%08" PRIx64, SectionAddress) << "):\n";
+    }
+
+    void PrintLines(raw_ostream &OS, StringRef Contents, uint64_t Address, uint64_t Begin, uint64_t End,
+                    uint64_t Erased, uint64_t &LastBaseAddr) const {
+        ForEachLine(Contents, Address, Begin, End, Erased, LastBaseAddr,
+                    [&](uint64_t addr, uint64_t Size, uint64_t Base, bool NewBase) {
+            if (NewBase) {
+                unsigned char Sum = 6 + (Base & 0xff) + ((Base >> 8) & 0xff);
+                OS << format(":02000004%04" PRIx64 "%02" PRIx8 "\n", Base, (unsigned char)(-Sum));
+            }
+
+            StringRef Line = Contents.substr(addr, Size);
+            NoteRecord(OS, Address + addr, Line);
+            EncodeRecord(OS, Address + addr, Line);
+        });
+    }
+
+    // Cut the output into pieces of PieceBytes bytes of input, and work out
+    // the size and place of each from the lengths of the records it will
+    // hold.  Returns the size of the whole output.
+    static uint64_t Plan(ArrayRef<SectionData> Sections, uint64_t PieceBytes, std::vector<HexPiece> &Pieces) {
+        uint64_t Offset = 0;
+        for (size_t s = 0, se = Sections.size(); s != se; ++s) {
+            const SectionData &Section  = Sections[s];
+            uint64_t           Size     = Section.Contents.size();
+            uint64_t           Erased   = ErasedFrom(Section.Contents);
+            uint64_t           LastBase = UINT64_MAX;
+
+            for (uint64_t Begin = 0; Begin == 0 || Begin < Size; Begin += PieceBytes) {
+                HexPiece Piece;
+                Piece.Section  = s;
+                Piece.Begin    = Begin;
+                Piece.End      = std::min(Begin + PieceBytes, Size);
+                Piece.LastBase = LastBase;
+                Piece.Erased   = Erased;
+                Piece.Offset   = Offset;
+                Piece.Size     = 0;
+                if (Begin == 0) {
+                    // "; Contents of section <name>(@<address>):\n"
+                    Piece.Size = 22 + Section.Name.size() + 2 + HexDigits(Section.Address, 8) + 3;
+                }
+
+                // ":02000004<base><sum>\n" and ":<size><addr>00<data><sum>\n"
+                ForEachLine(Section.Contents, Section.Address, Piece.Begin, Piece.End, Erased, LastBase,
+                            [&](uint64_t, uint64_t LineSize, uint64_t Base, bool NewBase) {
+                    if (NewBase) Piece.Size += 12 + HexDigits(Base, 4);
+                    Piece.Size += 12 + 2 * LineSize;
+                });
+
+                Offset += Piece.Size;
+                Pieces.push_back(Piece);
+            }
+        }
+        return Offset;
+    }
+
+#ifdef LLVM_ON_UNIX
+    bool WritePieces(ArrayRef<SectionData> Sections, StringRef OutputFilename) const {
+        // Each worker holds one encoded piece, under --memory-limit no more
+        // than an output buffer's worth.
+        uint64_t PieceBytes = 1 << 20;
+        if (MemoryBudget != 0) PieceBytes = std::max<uint64_t>(16, (OutputBufferSize / 3) & ~uint64_t(15));
+
+        std::vector<HexPiece> Pieces;
+        uint64_t              Total = Plan(Sections, PieceBytes, Pieces);
+
+        int FD = ::open(OutputFilename.str().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (FD < 0) {
+            errs() << ToolName << ": '" << OutputFilename << "': " << strerror(errno) << ".\n";
+            return false;
+        }
+        // Like tool_output_file, do not leave a partial file behind if
+        // interrupted.
+        sys::RemoveFileOnSignal(OutputFilename);
+
+        // Where the file system cannot preallocate, just set the size.
+        std::atomic<int>  Error(Total != 0 ? ::posix_fallocate(FD, 0, Total) : 0);
+        std::atomic<bool> Misplanned(false);
+        if (Error != 0 && ::ftruncate(FD, Total) == 0) Error = 0;
+
+        if (Error == 0) {
+            ParallelFor(Pieces.size(), [&](size_t i) {
+                const HexPiece    &Piece    = Pieces[i];
+                const SectionData &Section  = Sections[Piece.Section];
+                StringRef          Input    = Section.Contents.slice(Piece.Begin, Piece.End);
+                uint64_t           LastBase = Piece.LastBase;
+                std::string       *Buffer   = Buffers.acquire();
+                const std::string &Encoded  = *Buffer;
+                raw_string_ostream OS(*Buffer);
+
+                Buffer->reserve(Piece.Size);
+                // The lines go straight into the pooled buffer, not through
+                // a stream buffer allocated for each piece.
+                OS.SetUnbuffered();
+                Mappings.willNeed(Input);
+                if (Piece.Begin == 0) PrintHeader(OS, Section.Name, Section.Address);
+                PrintLines(OS, Section.Contents, Section.Address, Piece.Begin, Piece.End, Piece.Erased, LastBase);
+                OS.flush();
+                Mappings.consumed(Input);
+                if (Encoded.size() != Piece.Size) {
+                    Misplanned = true;
+                    Buffers.release(Buffer);
+                    return false;
+                }
+
+                const char *Data   = Encoded.data();
+                size_t      Left   = Encoded.size();
+                off_t       Offset = Piece.Offset;
+                while (Left != 0) {
+                    ssize_t Written = ::pwrite(FD, Data, Left, Offset);
+                    if (Written < 0) {
+                        if (errno == EINTR) continue;
+                        Error = errno;
+                        break;
+                    }
+                    Data   += Written;
+                    Left   -= Written;
+                    Offset += Written;
+                }
+                Buffers.release(Buffer);
+                return Left == 0;
+            });
+        }
+
+        if (::close(FD) != 0 && Error == 0) Error = errno;
+        if (Misplanned) {
+            errs() << ToolName << ": '" << OutputFilename << "': Intel Hex output differs from its planned layout.\n";
+        } else if (Error != 0) {
+            errs() << ToolName << ": '" << OutputFilename << "': " << strerror(Error) << ".\n";
+        }
+        if (Misplanned || Error != 0) sys::fs::remove(OutputFilename);
+        sys::DontRemoveFileOnSignal(OutputFilename);
+        return !Misplanned && Error == 0;
+    }
+#endif
+};
+
+class ObjectCopyReadMemH : public ObjectCopyBase {
+public:
+    ObjectCopyReadMemH(StringRef InputFilename) 
+        : ObjectCopyBase(InputFilename) {}
+    virtual ~ObjectCopyReadMemH() {}
+
+protected:
+    virtual void PrintSection(raw_ostream &OS, const StringRef &SectionName,
+                              const StringRef &SectionContents, uint64_t SectionAddress) const
+    {
+        uint64_t addr = 0;
+        uint64_t end  = SectionContents.size();
+        while (addr < end) {
+            uint64_t next = end;
+            if (SkipErased) {
+                // Leave out erased bytes and restart at the next address.
+                addr += ErasedRunLength(SectionContents.substr(addr), GapFill);
+                if (addr == end) break;
+
+                // Restarting costs an "@<address>" line, so only runs that
+                // take up more than that as three-byte lines, or that end
+                // the section, are left out.
+                for (uint64_t i = addr; i < end; ) {
+                    const void *Erased = memchr(SectionContents.data() + i, GapFill, end - i);
+                    if (!Erased) break;
+                    i = static_cast<const char *>(Erased) - SectionContents.data();
+
+                    uint64_t Run = ErasedRunLength(SectionContents.slice(i, end), GapFill);
+                    if (i + Run == end || 3 * Run > 2 + HexDigits(SectionAddress + i + Run, 1)) {
+                        next = i;
+                        break;
+                    }
+                    i += Run;
+                }
+            }
+
+            // Dump address
+            OS << "@" << format("%" PRIx64, SectionAddress + addr) << "\n";
+
+            StringRef Run = SectionContents.slice(addr, next);
+            NoteRecord(OS, SectionAddress + addr, Run);
+            EncodeRecord(OS, SectionAddress + addr, Run);
+            addr = next;
+        }
+    }
+
+    virtual void EncodeRecord(raw_ostream &OS, uint64_t Address, StringRef Data) const
+    {
+        for (uint64_t addr = 0, end = Data.size(); addr < end; ++addr) {
+            // Dump hex value.
+            OS << format("%02" PRIx8 "\n", (unsigned char)(Data[addr]));
+        }
+    }
+
+    // Every byte is a line of its own, "xx\n".
+    virtual bool PatchRecord(std::string &Image, const OutputRecord &Record, uint64_t Offset,
+                             StringRef Bytes) const
+    {
+        static const char Digits[] = "0123456789abcdef";
+        char *Line = &Image[Record.Offset + 3 * Offset];
+        for (size_t i = 0, e = Bytes.size(); i != e; ++i, Line += 3) {
+            Line[0] = Digits[(unsigned char)Bytes[i] >> 4];
+            Line[1] = Digits[(unsigned char)Bytes[i] & 0xf];
+        }
+        return true;
+    }
+};
+
+class ObjectCopyBinary : public ObjectCopyBase {
+public:
+    ObjectCopyBinary(StringRef InputFilename) 
+        : ObjectCopyBase(InputFilename)
+    {
+        mBinaryOutput = true;
+        mFillGaps     = true;
+        mTrimErased   = true;
+    }
+    virtual ~ObjectCopyBinary() {}
+
+protected:
+    virtual void PrintSection(raw_ostream &OS, const StringRef &SectionName,
+                              const StringRef &SectionContents, uint64_t SectionAddress) const
+    {
+        NoteRecord(OS, SectionAddress, SectionContents);
+        EncodeRecord(OS, SectionAddress, SectionContents);
+    }
+
+    virtual void EncodeRecord(raw_ostream &OS, uint64_t Address, StringRef Data) const
+    {
+        OS << Data;
+    }
+
+    virtual bool PatchRecord(std::string &Image, const OutputRecord &Record, uint64_t Offset,
+                             StringRef Bytes) const
+    {
+        memcpy(&Image[Record.Offset + Offset], Bytes.data(), Bytes.size());
+        return true;
+    }
+
+    virtual void FillGap(raw_ostream &OS, unsigned char Value, uint64_t Size) const
+    {
+        char Fill[4096];
+        memset(Fill, Value, std::min<uint64_t>(Size, sizeof(Fill)));
+        while (Size != 0) {
+            size_t N = std::min<uint64_t>(Size, sizeof(Fill));
+            OS.write(Fill, N);
+            Size -= N;
+        }
+    }
+};
+
+// The binary image, compressed.  The blocks are cut from the image as it is
+// generated, so no uncompressed copy is ever written or read back.
+class ObjectCopyBinaryLZ4 : public ObjectCopyBinary {
+public:
+    ObjectCopyBinaryLZ4(StringRef InputFilename) 
+        : ObjectCopyBinary(InputFilename)
+    {
+    }
+    virtual ~ObjectCopyBinaryLZ4() {}
+
+protected:
+    virtual bool WriteSections(ArrayRef<SectionData> Sections, raw_ostream &OS) const {
+        BlockCompressingOstream Blocks(OS, CompressBlockSize);
+        if (!ObjectCopyBinary::WriteSections(Sections, Blocks)) return false;
+        Blocks.finish();
+        return true;
+    }
+};
+
+// The binary image as source code for a C compiler or an assembler.  The
+// image is followed by a symbol giving its size in bytes.
+class ObjectCopySource : public ObjectCopyBinary {
+public:
+    ObjectCopySource(StringRef InputFilename, bool Assembly)
+        : ObjectCopyBinary(InputFilename)
+        , mAssembly(Assembly)
+        , mName(ArrayName)
+    {
+        mBinaryOutput = false;
+
+        if (mName.empty()) {
+            StringRef Stem = sys::path::stem(InputFilename);
+            if (Stem.empty() || isdigit(static_cast<unsigned char>(Stem[0]))) mName = "_";
+            for (size_t i = 0, e = Stem.size(); i != e; ++i) {
+                mName += isalnum(static_cast<unsigned char>(Stem[i])) ? Stem[i] : '_';
+            }
+        }
+    }
+    virtual ~ObjectCopySource() {}
+
+protected:
+    virtual bool WriteSections(ArrayRef<SectionData> Sections, raw_ostream &OS) const {
+        static const char *const CTypes[]    = { "uint8_t", "uint16_t", "", "uint32_t", "", "", "", "uint64_t" };
+        static const char *const Directive[] = { ".byte", ".2byte", "", ".4byte", "", "", "", ".8byte" };
+        unsigned Width     = ArrayElementWidth;
+        bool     BigEndian = ElementsBigEndian;
+
+        if (mAssembly) {
+            OS << "\t.section .rodata\n"
+               << "\t.balign " << Width << "\n"
+               << "\t.globl " << mName << "\n"
+               << "\t.type " << mName << ", %object\n"
+               << mName << ":\n";
+            if (!IncbinFile.empty()) OS << "\t.incbin \"" << IncbinFile << "\"\n";
+        } else {
+            // The extern declarations give the definitions external linkage
+            // when the file is compiled as C++ too.
+            OS << "#include <stddef.h>\n"
+               << "#include <stdint.h>\n\n"
+               << "extern const " << CTypes[Width - 1] << " " << mName << "[];\n"
+               << "extern const size_t " << mName << "_size;\n\n"
+               << "const " << CTypes[Width - 1] << " " << mName << "[] = {\n";
+        }
+
+        std::string        Prefix = mAssembly ? std::string("\t") + Directive[Width - 1] + " " : std::string("  ");
+        SourceArrayOstream Array(OS, Prefix, mAssembly ? "\n" : ",\n", Width, BigEndian,
+                                 mAssembly && !IncbinFile.empty());
+        if (!ObjectCopyBinary::WriteSections(Sections, Array)) return false;
+        uint64_t Size = Array.tell();
+        Array.finish();
+
+        if (mAssembly) {
+            OS << "\t.size " << mName << ", " << Size << "\n"
+               << "\t.globl " << mName << "_size\n"
+               << "\t.set " << mName << "_size, " << Size << "\n";
+        } else {
+            if (Array.elements() == 0) OS << "  0\n";
+            OS << "};\n"
+               << "const size_t " << mName << "_size = " << Size << ";\n";
+        }
+        return true;
+    }
+
+private:
+    bool        mAssembly;
+    std::string mName;
+};
+
+static bool ParseOutputFormat(StringRef Name, OutputFormatTy &Format) {
+    if (Name == "binary") {
+        Format = binary;
+    } else if (Name == "binary_lz4") {
+        Format = binary_lz4;
+    } else if (Name == "intel_hex") {
+        Format = intel_hex;
+    } else if (Name == "readmemh") {
+        Format = readmemh;
+    } else if (Name == "c_array") {
+        Format = c_array;
+    } else if (Name == "asm") {
+        Format = assembly;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static ObjectCopyBase *CreateObjectCopy(OutputFormatTy Format) {
+    switch (Format) {
+    case OutputFormatTy::binary:
+        return new ObjectCopyBinary(InputFilenames[0]);
+    case OutputFormatTy::binary_lz4:
+        return new ObjectCopyBinaryLZ4(InputFilenames[0]);
+    case OutputFormatTy::intel_hex:
+        return new ObjectCopyIntelHex(InputFilenames[0]);
+    case OutputFormatTy::readmemh:
+        return new ObjectCopyReadMemH(InputFilenames[0]);
+    case OutputFormatTy::c_array:
+        return new ObjectCopySource(InputFilenames[0], false);
+    case OutputFormatTy::assembly:
+        return new ObjectCopySource(InputFilenames[0], true);
+    case OutputFormatTy::elf:
+        break;
+    }
+    llvm_unreachable("not a section based output format");
+}
+
+// One output file to produce.  Region selects the list of sections it is
+// generated from: 0 for everything outside the --region ranges, otherwise the
+// sections routed to region Region - 1.
+struct OutputSpec {
+    OutputFormatTy  Format;
+    std::string     Filename;
+    unsigned        Region;
+
+    OutputSpec(OutputFormatTy Format, StringRef Filename, unsigned Region)
+        : Format(Format), Filename(Filename), Region(Region) {}
+};
+
+// An address range given with --region, whose sections get an output file
+// of their own.
+struct MemoryRegion {
+    uint64_t    Begin;
+    uint64_t    End;
+    std::string Filename;
+};
+
+// Parse "<start>-<end>=<file>".
+static bool ParseRegion(StringRef Spec, MemoryRegion &Region) {
+    std::pair<StringRef, StringRef> RangeAndFile = Spec.split('=');
+    std::pair<StringRef, StringRef> Bounds = RangeAndFile.first.split('-');
+    if (   Bounds.first.getAsInteger(0, Region.Begin)
+        || Bounds.second.getAsInteger(0, Region.End)
+        || Region.End <= Region.Begin
+        || RangeAndFile.second.empty()) {
+        return false;
+    }
+    Region.Filename = RangeAndFile.second;
+    return true;
+}
+
+// Distribute Sections over Lists: the bytes inside region i go to
+// Lists[i + 1], anything else to Lists[0].  A section crossing a region
+// boundary is cut there, as --address-range cuts sections.  Each list becomes
+// an output of its own, so gaps are never filled across region boundaries.
+// The regions must not overlap.
+static void SplitRegions(ArrayRef<SectionData> Sections, ArrayRef<MemoryRegion> Regions,
+                         std::vector<std::vector<SectionData> > &Lists) {
+    Lists.resize(Regions.size() + 1);
+    for (size_t i = 0, e = Sections.size(); i != e; ++i) {
+        const SectionData &Section = Sections[i];
+        uint64_t           End     = Section.Address + Section.Contents.size();
+
+        for (uint64_t Cursor = Section.Address; Cursor < End; ) {
+            unsigned List     = 0;
+            uint64_t PartEnd  = End;
+            for (size_t r = 0, re = Regions.size(); r != re; ++r) {
+                if (Cursor >= Regions[r].Begin && Cursor < Regions[r].End) {
+                    List    = r + 1;
+                    PartEnd = std::min(End, Regions[r].End);
+                    break;
+                }
+                if (Regions[r].Begin > Cursor) PartEnd = std::min(PartEnd, Regions[r].Begin);
+            }
+
+            SectionData Part = Section;
+            Part.Address  = Cursor;
+            Part.Contents = Section.Contents.slice(Cursor - Section.Address, PartEnd - Section.Address);
+            Lists[List].push_back(Part);
+            Cursor = PartEnd;
+        }
+    }
+}
+
+// A symbol whose bytes are replaced for each device by --personalize.
+struct PatchSite {
+    StringRef           Symbol;
+    uint64_t            Address;
+    uint64_t            Size;
+    std::vector<size_t> Records;    // Indices of the output records it overlaps.
+};
+
+// Parse hex digits, optionally separated by ':' or '-', into bytes.
+static bool ParseHexBytes(StringRef Str, std::string &Bytes) {
+    unsigned      Digits = 0;
+    unsigned char Byte   = 0;
+
+    Bytes.clear();
+    for (size_t i = 0, e = Str.size(); i != e; ++i) {
+        if (Str[i] == ':' || Str[i] == '-') continue;
+
+        unsigned Value = hexDigitValue(Str[i]);
+        if (Value == -1U) return false;
+
+        Byte = (Byte << 4) | Value;
+        if (++Digits % 2 == 0) {
+            Bytes += char(Byte);
+            Byte = 0;
+        }
+    }
+    return Digits % 2 == 0;
+}
+
+// Implement --personalize.  The primary output is encoded once as a template;
+// for every device only the bytes of the patched symbols are rewritten in it:
+// in place where the format allows, otherwise (Intel Hex, whose lines carry
+// a checksum) by encoding the lines covering them again.
+//
+// The first line of the CSV file is a label for the file name column followed
+// by the names of the symbols to patch, e.g. "file,serial_no,mac_addr".  Every
+// further line gives an output file name and the new bytes of each symbol in
+// hex; each value must be exactly as long as its symbol.
+static bool Personalize(ArrayRef<ObjectFile *> Objects, ArrayRef<SectionData> Sections, StringRef CSVFilename) {
+    OwningPtr<MemoryBuffer> CSV;
+    if (error_code ec = MemoryBuffer::getFile(CSVFilename, CSV)) {
+        errs() << ToolName << ": '" << CSVFilename << "': " << ec.message() << ".\n";
+        return false;
+    }
+
+    SmallVector<StringRef, 256> Lines;
+    CSV->getBuffer().split(Lines, "\n", -1, false);
+    if (Lines.empty()) {
+        errs() << ToolName << ": '" << CSVFilename << "': no header line\n";
+        return false;
+    }
+
+    SmallVector<StringRef, 8> Header;
+    Lines[0].trim().split(Header, ",");
+
+    std::vector<PatchSite> Sites(Header.size() - 1);
+    for (size_t i = 0, e = Sites.size(); i != e; ++i) {
+        Sites[i].Symbol  = Header[i + 1].trim();
+        Sites[i].Address = UINT64_MAX;
+        Sites[i].Size    = 0;
+    }
+
+    // Resolve the patched symbols in a single walk over each symbol table.
+    // The sections of a PE image are placed at ImageBase plus their RVA (see
+    // CollectPESection), and so are its symbols.  A name defined more than
+    // once, in one input or several, does not say which copy to patch;
+    // references from other inputs are not definitions.
+    error_code ec;
+    for (size_t o = 0, oe = Objects.size(); o != oe; ++o) {
+        PEImage  Image(Objects[o]);
+        uint64_t Base = Image.isImage() ? Image.getImageBase() : 0;
+
+        for (symbol_iterator si = Objects[o]->begin_symbols(), se = Objects[o]->end_symbols(); si != se; si.increment(ec)) {
+            if (error(ec)) return false;
+
+            StringRef Name;
+            uint32_t  Flags;
+            if (error(si->getName(Name))) return false;
+            if (error(si->getFlags(Flags))) return false;
+            if (Flags & SymbolRef::SF_Undefined) continue;
+
+            for (size_t i = 0, e = Sites.size(); i != e; ++i) {
+                if (Sites[i].Symbol != Name) continue;
+                if (Sites[i].Address != UINT64_MAX) {
+                    errs() << ToolName << ": symbol '" << Name << "' is defined more than once\n";
+                    return false;
+                }
+                if (error(si->getAddress(Sites[i].Address))) return false;
+                if (error(si->getSize(Sites[i].Size))) return false;
+                Sites[i].Address += Base;
+            }
+        }
+    }
+
+    OwningPtr<ObjectCopyBase> ObjectCopy(CreateObjectCopy(OutputTarget));
+    std::string               Image;
+    std::vector<OutputRecord> Records;
+    if (!ObjectCopy->EncodeTemplate(Sections, Image, Records)) return false;
+
+    // Find the records overlapping each symbol; together they must cover it.
+    for (size_t i = 0, e = Sites.size(); i != e; ++i) {
+        PatchSite &Site = Sites[i];
+        if (Site.Address == UINT64_MAX || Site.Size == 0) {
+            errs() << ToolName << ": symbol '" << Site.Symbol << "' not found or has no size\n";
+            return false;
+        }
+
+        uint64_t Covered = 0;
+        for (size_t r = 0, re = Records.size(); r != re; ++r) {
+            uint64_t Begin = std::max(Site.Address, Records[r].Address);
+            uint64_t End   = std::min(Site.Address + Site.Size, Records[r].Address + Records[r].Data.size());
+            if (Begin >= End) continue;
+
+            Site.Records.push_back(r);
+            Covered += End - Begin;
+        }
+        if (Covered != Site.Size) {
+            errs() << ToolName << ": symbol '" << Site.Symbol << "' is not completely contained in the output\n";
+            return false;
+        }
+    }
+
+    // Every device rewrites the same records in full, so the template never
+    // needs to be restored between devices.
+    std::string Bytes;
+    for (size_t Line = 1, LineEnd = Lines.size(); Line != LineEnd; ++Line) {
+        StringRef Row = Lines[Line].trim();
+        if (Row.empty()) continue;
+
+        SmallVector<StringRef, 8> Fields;
+        Row.split(Fields, ",");
+        if (Fields.size() != Sites.size() + 1) {
+            errs() << ToolName << ": '" << CSVFilename << "': line " << Line + 1 << ": expected "
+                   << Sites.size() + 1 << " fields\n";
+            return false;
+        }
+
+        // Records that cannot be patched in place, with their new data.
+        std::map<size_t, std::string> Patched;
+        for (size_t i = 0, e = Sites.size(); i != e; ++i) {
+            const PatchSite &Site = Sites[i];
+            if (!ParseHexBytes(Fields[i + 1].trim(), Bytes) || Bytes.size() != Site.Size) {
+                errs() << ToolName << ": '" << CSVFilename << "': line " << Line + 1 << ": invalid value for '"
+                       << Site.Symbol << "'\n";
+                return false;
+            }
+
+            for (size_t r = 0, re = Site.Records.size(); r != re; ++r) {
+                const OutputRecord &Record = Records[Site.Records[r]];
+                uint64_t Begin = std::max(Site.Address, Record.Address);
+                uint64_t End   = std::min(Site.Address + Site.Size, Record.Address + Record.Data.size());
+                StringRef Patch = StringRef(Bytes).substr(Begin - Site.Address, End - Begin);
+                if (ObjectCopy->PatchRecord(Image, Record, Begin - Record.Address, Patch)) continue;
+
+                std::map<size_t, std::string>::iterator It = Patched.find(Site.Records[r]);
+                if (It == Patched.end()) {
+                    It = Patched.insert(std::make_pair(Site.Records[r], Record.Data.str())).first;
+                }
+                It->second.replace(Begin - Record.Address, Patch.size(), Patch.data(), Patch.size());
+            }
+        }
+
+        for (std::map<size_t, std::string>::iterator It = Patched.begin(), E = Patched.end(); It != E; ++It) {
+            const OutputRecord &Record = Records[It->first];
+            std::string         Encoded;
+            raw_string_ostream  OS(Encoded);
+            ObjectCopy->EncodeRecord(OS, Record.Address, It->second);
+            OS.flush();
+
+            assert(Record.Offset + Encoded.size() <= Image.size() && "re-encoded record changed size");
+            Image.replace(Record.Offset, Encoded.size(), Encoded);
+        }
+
+        if (!ObjectCopy->WriteImage(Image, Fields[0].trim().str())) return false;
+    }
+
+    return true;
+}
+
+// Combine the sections of several inputs into one layout, ordered by address.
+// Sections from different inputs must not overlap.
+static bool MergeSections(ArrayRef<ObjectFile *> Objects, ArrayRef<std::vector<SectionData> > Inputs,
+                          std::vector<SectionData> &Sections) {
+    std::vector<std::pair<SectionData, size_t> > All;
+    for (size_t i = 0, e = Inputs.size(); i != e; ++i) {
+        for (size_t s = 0, se = Inputs[i].size(); s != se; ++s) {
+            All.push_back(std::make_pair(Inputs[i][s], i));
+        }
+    }
+
+    struct CompareFirst {
+        bool operator()(const std::pair<SectionData, size_t> &A, const std::pair<SectionData, size_t> &B) const {
+            return CompareAddress(A.first, B.first);
+        }
+    };
+    std::stable_sort(All.begin(), All.end(), CompareFirst());
+
+    // A section overlaps an earlier one of another input if it starts before
+    // the furthest end among those.  That is the furthest end of all unless
+    // it comes from the same input, so the sections with the furthest end
+    // and with the furthest end from any other input are kept track of.
+    size_t Furthest[2] = { SIZE_MAX, SIZE_MAX };
+    for (size_t i = 0, e = All.size(); i != e; ++i) {
+        const SectionData &Cur = All[i].first;
+        size_t             Other = Furthest[0] != SIZE_MAX && All[Furthest[0]].second == All[i].second
+                                       ? Furthest[1] : Furthest[0];
+        if (Other != SIZE_MAX) {
+            const SectionData &Prev = All[Other].first;
+            if (Prev.Address + Prev.Contents.size() > Cur.Address) {
+                errs() << ToolName << ": section " << Prev.Name << " of '" << Objects[All[Other].second]->getFileName()
+                       << "' overlaps section " << Cur.Name << " of '" << Objects[All[i].second]->getFileName()
+                       << "' at " << format("0x%" PRIx64, Cur.Address) << "\n";
+                return false;
+            }
+        }
+
+        uint64_t End = Cur.Address + Cur.Contents.size();
+        if (Furthest[0] == SIZE_MAX || End > All[Furthest[0]].first.Address + All[Furthest[0]].first.Contents.size()) {
+            if (Furthest[0] != SIZE_MAX && All[Furthest[0]].second != All[i].second) Furthest[1] = Furthest[0];
+            Furthest[0] = i;
+        } else if (   All[Furthest[0]].second != All[i].second
+                   && (   Furthest[1] == SIZE_MAX
+                       || End > All[Furthest[1]].first.Address + All[Furthest[1]].first.Contents.size())) {
+            Furthest[1] = i;
+        }
+    }
+
+    Sections.reserve(All.size());
+    for (size_t i = 0, e = All.size(); i != e; ++i) {
+        Sections.push_back(All[i].first);
+    }
+    return true;
+}
+
+// Collect the sections of the inputs, merging them when there are several,
+// and pad them out to flash sectors if requested.
+static bool PrepareSections(ArrayRef<ObjectFile *> Objects, const FlashLayout &Flash, std::vector<SectionData> &Sections) {
+    if (Objects.size() == 1) {
+        if (!CollectSections(Objects[0], Sections)) return false;
+    } else {
+        std::vector<std::vector<SectionData> > Inputs(Objects.size());
+        bool Collected = ParallelFor(Objects.size(), [&](size_t i) {
+            return CollectSections(Objects[i], Inputs[i]);
+        });
+        if (!Collected || !MergeSections(Objects, Inputs, Sections)) return false;
+    }
+
+    if (!Flash.empty()) Flash.pad(Sections);
+    return true;
+}
+
+// Names of the Mach-O CPU types, as used by --arch.
+struct MachOArch {
+    uint32_t    CPUType;
+    const char *Name;
+};
+
+static const MachOArch MachOArchs[] = {
+    { 7,          "i386" },
+    { 0x01000007, "x86_64" },
+    { 12,         "arm" },
+    { 0x0100000c, "arm64" },
+    { 18,         "ppc" },
+    { 0x01000012, "ppc64" },
+};
+
+static std::string MachOArchName(uint32_t CPUType) {
+    for (size_t i = 0, e = array_lengthof(MachOArchs); i != e; ++i) {
+        if (MachOArchs[i].CPUType == CPUType) return MachOArchs[i].Name;
+    }
+    return "cpu" + utostr(CPUType);
+}
+
+// The input object files.  Several are opened and parsed concurrently.  A
+// Mach-O universal binary contributes its --arch slice or, without --arch,
+// all of its slices; these are then converted one by one (see
+// ConvertSlices), which only works when it is the only input.
+class InputFiles {
+public:
+    ~InputFiles() {
+        DeleteContainerPointers(mSliceObjects);
+        DeleteContainerPointers(mBinaries);
+    }
+
+    bool open(ArrayRef<std::string> Filenames) {
+        std::vector<std::vector<ObjectFile *> > Slices(Filenames.size());
+        std::vector<std::vector<std::string> >  Archs(Filenames.size());
+        mBinaries.assign(Filenames.size(), NULL);
+
+        bool Opened = ParallelFor(Filenames.size(), [&](size_t i) {
+            const std::string &Filename = Filenames[i];
+
+            // If file isn't stdin, check that it exists.
+            if (Filename != "-" && !sys::fs::exists(Filename)) {
+                errs() << ToolName << ": '" << Filename << "': " << "No such file\n";
+                return false;
+            }
+
+            // Attempt to open  binary.
+            OwningPtr<Binary> binary;
+            if (error_code ec = Mappings.open(Filename, binary)) {
+                errs() << ToolName << ": '" << Filename << "': " << ec.message() << ".\n";
+                return false;
+            }
+            mBinaries[i] = binary.take();
+
+            if (MachOUniversalBinary *Fat = dyn_cast<MachOUniversalBinary>(mBinaries[i])) {
+                return openSlices(Filename, Fat, Slices[i], Archs[i]);
+            }
+            if (ObjectFile *o = dyn_cast<ObjectFile>(mBinaries[i])) {
+                Slices[i].push_back(o);
+                return true;
+            }
+            errs() << ToolName << ": '" << Filename << "': " << "Unrecognized file type.\n";
+            return false;
+        });
+
+        for (size_t i = 0, e = Filenames.size(); i != e; ++i) {
+            if (!Archs[i].empty()) mSliceObjects.insert(mSliceObjects.end(), Slices[i].begin(), Slices[i].end());
+        }
+        if (!Opened) return false;
+
+        for (size_t i = 0, e = Filenames.size(); i != e; ++i) {
+            if (Slices[i].size() > 1 && Filenames.size() > 1) {
+                errs() << ToolName << ": '" << Filenames[i] << "' has several architectures; select one with --arch\n";
+                return false;
+            }
+            mObjects.insert(mObjects.end(), Slices[i].begin(), Slices[i].end());
+            if (Slices[i].size() > 1) mArchs = Archs[i];
+        }
+        return true;
+    }
+
+    ArrayRef<ObjectFile *> objects() const { return mObjects; }
+
+    // The architecture of each object when they are the slices of a single
+    // universal binary, to be converted separately; empty otherwise.
+    ArrayRef<std::string> archs() const { return mArchs; }
+
+private:
+    // Parse the slices of Fat that were asked for.  The slices refer to the
+    // data of Fat, so it stays open as long as they do.
+    static bool openSlices(StringRef Filename, const MachOUniversalBinary *Fat,
+                           std::vector<ObjectFile *> &Objects, std::vector<std::string> &Archs) {
+        std::vector<std::string> Seen;
+        for (MachOUniversalBinary::object_iterator I = Fat->begin_objects(), E = Fat->end_objects(); I != E; ++I) {
+            // Slices for variants of one CPU type, say armv7 and armv7s, are
+            // told apart by their position: arm, arm.1 and so on.
+            std::string Arch  = MachOArchName(I->getCPUType());
+            unsigned    Count = std::count(Seen.begin(), Seen.end(), Arch);
+            Seen.push_back(Arch);
+            if (Count != 0) Arch += "." + utostr(Count);
+
+            if (!SliceArch.empty() && Arch != SliceArch) continue;
+
+            OwningPtr<ObjectFile> Slice;
+            if (error_code ec = I->getAsObjectFile(Slice)) {
+                errs() << ToolName << ": '" << Filename << "' (" << Arch << "): " << ec.message() << ".\n";
+                return false;
+            }
+            Objects.push_back(Slice.take());
+            Archs.push_back(Arch);
+        }
+
+        if (Objects.empty()) {
+            errs() << ToolName << ": '" << Filename << "': no " << (SliceArch.empty() ? "" : SliceArch + " ")
+                   << "slice in universal binary\n";
+            return false;
+        }
+        return true;
+    }
+
+    std::vector<Binary *>       mBinaries;
+    std::vector<ObjectFile *>   mSliceObjects;
+    std::vector<ObjectFile *>   mObjects;
+    std::vector<std::string>    mArchs;
+};
+
+// Implement --delta-from: build the flat binary image of the primary output
+// for both the old input and the current one, and write the delta between
+// them.
+static bool WriteDeltaFrom(StringRef OldFilename, const FlashLayout &Flash, ArrayRef<MemoryRegion> Regions,
+                           ArrayRef<SectionData> NewSections) {
+    OwningPtr<Binary> OldBinary;
+    if (error_code ec = createBinary(OldFilename, OldBinary)) {
+        errs() << ToolName << ": '" << OldFilename << "': " << ec.message() << ".\n";
+        return false;
+    }
+
+    ObjectFile *Old = dyn_cast<ObjectFile>(OldBinary.get());
+    if (Old == NULL) {
+        errs() << ToolName << ": '" << OldFilename << "': " << "Unrecognized file type.\n";
+        return false;
+    }
+
+    std::vector<SectionData>               OldSections;
+    std::vector<std::vector<SectionData> > OldLists;
+    if (!PrepareSections(Old, Flash, OldSections)) return false;
+    SplitRegions(OldSections, Regions, OldLists);
+
+    ObjectCopyBinary ImageBuilder(OldFilename);
+    std::string      OldImage;
+    std::string      NewImage;
+    if (!ImageBuilder.Encode(OldLists[0], OldImage)) return false;
+    if (!ImageBuilder.Encode(NewSections, NewImage)) return false;
+
+    return writeDelta(OldImage, NewImage, DeltaOutput, DeltaManifest);
+}
+
+static bool WriteOutput(ArrayRef<SectionData> Sections, const OutputSpec &Output) {
+    OwningPtr<ObjectCopyBase> ObjectCopy(CreateObjectCopy(Output.Format));
+
+    if (Verify) {
+        return ObjectCopy->VerifyAgainst(Sections, Output.Filename);
+    } else if (OnlyIfChanged) {
+        return ObjectCopy->UpdateIfChanged(Sections, Output.Filename);
+    }
+    return ObjectCopy->CopyTo(Sections, Output.Filename);
+}
+
+// Write every requested output.  The section lists are shared read-only, so
+// when there is more than one output they are handed out to a small pool of
+// worker threads; an output stalled on slow storage then no longer holds up
+// the others.
+static bool WriteOutputs(const std::vector<std::vector<SectionData> > &Lists, ArrayRef<OutputSpec> Outputs) {
+    return ParallelFor(Outputs.size(), [&](size_t i) {
+        return WriteOutput(Lists[Outputs[i].Region], Outputs[i]);
+    });
+}
+
+// Split what --memory-limit leaves after reading ahead and the inflated
+// sections evenly between the threads.  A thread works on one thing at a
+// time: an output, with its output buffer and, for binary_lz4, a batch of
+// blocks with their compressed copies, or else an Intel Hex piece or LZ4
+// block of an output another thread is writing, which takes less.  If the
+// shares are too small, fewer threads are used.  Called again once the
+// sections have been inflated, which can only shrink the shares.
+static void SplitMemoryBudget() {
+    uint64_t Available = MemoryBudget - ReadaheadWindow - Decompressed.reserved();
+    uint64_t Workers   = Threads ? unsigned(Threads) : std::thread::hardware_concurrency();
+    Workers = std::max<uint64_t>(1, std::min(Workers, Available / ShareMinimum));
+    Threads = Workers;
+    Pool.limit(Workers);
+
+    uint64_t Share        = Available / Workers;
+    uint64_t BatchMinimum = ShareMinimum - 4096;
+    if (OutputBufferSize > Share - BatchMinimum) OutputBufferSize = Share - BatchMinimum;
+    BatchMemory = Share - OutputBufferSize;
+}
+
+// Fit the buffers that do not grow with the input into --memory-limit.  Up
+// to a quarter of it goes to reading the input ahead.  Inflated compressed
+// sections stay in memory until the end, and may take what is left but for
+// the share of one thread; the rest is then split by SplitMemoryBudget.  The
+// input itself is only mapped, and its pages are dropped once written.
+static bool ApplyMemoryLimit(ArrayRef<OutputSpec> Outputs) {
+    if (!PersonalizeCSV.empty() || !DeltaFrom.empty() || PopulateInput) {
+        errs() << ToolName << ": --personalize, --delta-from and --populate-input keep whole images in memory, "
+               << "and cannot be used with --memory-limit\n";
+        return false;
+    }
+    if (Verify || OnlyIfChanged) {
+        errs() << ToolName << ": --verify and --only-if-changed read the whole existing output, "
+               << "and cannot be used with --memory-limit\n";
+        return false;
+    }
+    if (OutputTarget == elf) {
+        errs() << ToolName << ": -O elf and -I binary read whole sections and input files, "
+               << "and cannot be used with --memory-limit\n";
+        return false;
+    }
+
+    bool Compressing = false;
+    for (size_t i = 0, e = Outputs.size(); i != e; ++i) {
+        if (Outputs[i].Format == binary_lz4) Compressing = true;
+    }
+    ShareMinimum = 4096 + (Compressing ? 3 * uint64_t(CompressBlockSize) : 0);
+
+    ReadaheadWindow = std::min<uint64_t>(ReadaheadWindow, MemoryBudget / 4);
+    uint64_t Available = MemoryBudget - ReadaheadWindow;
+    if (Available < ShareMinimum) {
+        errs() << ToolName << ": --memory-limit must be at least " << (4 * ShareMinimum + 2) / 3
+               << " bytes for this output\n";
+        return false;
+    }
+    InflateMemory = Available - ShareMinimum;
+    SplitMemoryBudget();
+
+    Mappings.setReleaseConsumed(true);
+    return true;
+}
+
+// The output for one slice of a universal binary: a.bin becomes a.arm.bin,
+// a.x86_64.bin and so on.
+static std::string SliceOutputName(StringRef Filename, StringRef Arch) {
+    StringRef Extension = sys::path::extension(Filename);
+    return (Filename.drop_back(Extension.size()) + "." + Arch + Extension).str();
+}
+
+// Convert each slice of a universal binary to an output of its own.  The
+// slices are independent, so they are collected and written concurrently.
+static bool ConvertSlices(ArrayRef<ObjectFile *> Slices, ArrayRef<std::string> Archs, const FlashLayout &Flash) {
+    if (   OutputTarget == elf || OutputFilename == "-" || !ExtraOutputs.empty() || !MemoryRegions.empty()
+        || !FlashManifest.empty() || !PersonalizeCSV.empty() || !DeltaFrom.empty()) {
+        errs() << ToolName << ": '" << InputFilenames[0]
+               << "' has several architectures; select one with --arch for this output\n";
+        return false;
+    }
+
+    // Source output groups bytes into elements in a single byte order.
+    if ((OutputTarget == c_array || OutputTarget == assembly) && ArrayElementWidth > 1) {
+        for (size_t i = 1, e = Slices.size(); i != e; ++i) {
+            if (Slices[i]->isLittleEndian() != Slices[0]->isLittleEndian()) {
+                errs() << ToolName << ": slices of '" << InputFilenames[0]
+                       << "' differ in byte order; select one with --arch\n";
+                return false;
+            }
+        }
+    }
+
+    // All slices are collected before any is written, so that what their
+    // inflated sections take is known when --memory-limit is split.
+    std::vector<std::vector<SectionData> > Lists(Slices.size());
+    bool Collected = ParallelFor(Slices.size(), [&](size_t i) {
+        return PrepareSections(Slices[i], Flash, Lists[i]);
+    });
+    if (!Collected) return false;
+    if (MemoryBudget != 0) SplitMemoryBudget();
+
+    return ParallelFor(Slices.size(), [&](size_t i) {
+        return WriteOutput(Lists[i], OutputSpec(OutputTarget, SliceOutputName(OutputFilename, Archs[i]), 0));
+    });
+}
+
+// Sections removed by --strip-debug.  .gnu_debuglink stays, as it points at
+// the separate file the debug information has been moved to.
+static bool IsDebugSection(StringRef Name) {
+    return Name.startswith(".debug") || Name.startswith(".zdebug") ||
+           Name.startswith(".stab") || Name == ".line" || Name == ".gdb_index";
+}
+
+// Section selection for -O elf.
+static bool ShouldRemoveSection(StringRef Name) {
+    if (StripDebug && IsDebugSection(Name)) return true;
+    return !Filter.selectName(Name);
+}
+
+// -O elf: load the --update-section files and copy the input.
+static bool CopyELF(ObjectFile *o) {
+    std::vector<MemoryBuffer *> Buffers;
+    std::vector<SectionUpdate>  Updates;
+    bool                        Success = true;
+
+    for (size_t i = 0, e = UpdateSections.size(); i != e && Success; ++i) {
+        std::pair<StringRef, StringRef> Update = StringRef(UpdateSections[i]).split('=');
+        if (Update.first.empty() || Update.second.empty()) {
+            errs() << ToolName << ": invalid section update '" << UpdateSections[i] << "'\n";
+            Success = false;
+            break;
+        }
+
+        OwningPtr<MemoryBuffer> Contents;
+        if (error_code ec = MemoryBuffer::getFile(Update.second, Contents, -1, false)) {
+            errs() << ToolName << ": '" << Update.second << "': " << ec.message() << ".\n";
+            Success = false;
+            break;
+        }
+        Buffers.push_back(Contents.take());
+
+        SectionUpdate U = { Update.first, Buffers.back()->getBuffer() };
+        Updates.push_back(U);
+    }
+
+    if (Success) {
+        Success = copyELF(o, OutputFilename, ShouldRemoveSection, Updates);
+    }
+
+    DeleteContainerPointers(Buffers);
+    return Success;
+}
+
+// -I binary: wrap the raw contents of the input in a relocatable ELF object.
+static bool WrapBinary(StringRef InputFilename) {
+    OwningPtr<MemoryBuffer> Data;
+    if (error_code ec = MemoryBuffer::getFileOrSTDIN(InputFilename, Data)) {
+        errs() << ToolName << ": '" << InputFilename << "': " << ec.message() << ".\n";
+        return false;
+    }
+    return writeBinaryELF(Data->getBuffer(), InputFilename == "-" ? "stdin" : InputFilename,
+                          BinaryArchitecture, OutputFilename);
+}
+
+int main(int argc, char **argv) {
+    // Print a stack trace if we signal out.
+    sys::PrintStackTraceOnErrorSignal();
+    PrettyStackTraceProgram X(argc, argv);
+    llvm_shutdown_obj Y;  // Call llvm_shutdown() on exit.
+
+    cl::ParseCommandLineOptions(argc, argv, "llvm object file copy utility\n");
+
+    ToolName = argv[0];
+
+    if (!Filter.init(OnlySections, RemoveSections, AddressRanges)) {
+        return 1;
+    }
+
+    if (GapFill > 0xff) {
+        errs() << ToolName << ": --gap-fill value must fit in a byte\n";
+        return 1;
+    }
+
+    FlashLayout Flash;
+    if (!FlashLayoutSpec.empty() && !Flash.init(FlashLayoutSpec, GapFill)) {
+        return 1;
+    }
+    if (!FlashManifest.empty() && Flash.empty()) {
+        errs() << ToolName << ": --flash-manifest requires --flash-layout\n";
+        return 1;
+    }
+
+    if (   ArrayElementWidth != 1 && ArrayElementWidth != 2
+        && ArrayElementWidth != 4 && ArrayElementWidth != 8) {
+        errs() << ToolName << ": --array-element-width must be 1, 2, 4 or 8\n";
+        return 1;
+    }
+
+    if (CompressBlockSize == 0 || CompressBlockSize > 0x7fffffff) {
+        errs() << ToolName << ": invalid --compress-block-size\n";
+        return 1;
+    }
+
+    if (   !PersonalizeCSV.empty()
+        && (OutputTarget == binary_lz4 || OutputTarget == c_array || OutputTarget == assembly || OutputTarget == elf)) {
+        errs() << ToolName << ": --personalize only supports binary, intel_hex and readmemh output\n";
+        return 1;
+    }
+
+    if (InputFilenames.size() > 1 && OutputTarget == elf) {
+        errs() << ToolName << ": -O elf takes a single input file\n";
+        return 1;
+    }
+
+    if (InputTarget == binary_input && (OutputTarget != elf || InputFilenames.size() > 1)) {
+        errs() << ToolName << ": -I binary takes a single input file and requires -O elf\n";
+        return 1;
+    }
+
+    // -O elf copies the object file as a whole, without going through the
+    // section list that these options work on.
+    if (OutputTarget == elf) {
+        const char *Unsupported = 0;
+        if (Verify)                        Unsupported = "--verify";
+        else if (OnlyIfChanged)            Unsupported = "--only-if-changed";
+        else if (!ExtraOutputs.empty())    Unsupported = "--extra-output";
+        else if (!MemoryRegions.empty())   Unsupported = "--region";
+        else if (!DeltaFrom.empty())       Unsupported = "--delta-from";
+        else if (!FlashLayoutSpec.empty()) Unsupported = "--flash-layout";
+        else if (!FlashManifest.empty())   Unsupported = "--flash-manifest";
+        if (Unsupported) {
+            errs() << ToolName << ": " << Unsupported << " cannot be used with -O elf\n";
+            return 1;
+        }
+    }
+
+    if (!UpdateSections.empty() && OutputTarget != elf) {
+        errs() << ToolName << ": --update-section requires -O elf\n";
+        return 1;
+    }
+
+    if (!DeltaFrom.empty() && DeltaOutput.empty()) {
+        errs() << ToolName << ": --delta-from requires --delta-output\n";
+        return 1;
+    }
+
+    // The primary output, followed by any --extra-output and --region ones.
+    std::vector<OutputSpec> Outputs;
+    Outputs.push_back(OutputSpec(OutputTarget, OutputFilename, 0));
+
+    for (size_t i = 0, e = ExtraOutputs.size(); i != e; ++i) {
+        std::pair<StringRef, StringRef> Extra = StringRef(ExtraOutputs[i]).split('=');
+        OutputFormatTy Format;
+        if (Extra.second.empty() || !ParseOutputFormat(Extra.first, Format)) {
+            errs() << ToolName << ": invalid extra output '" << ExtraOutputs[i] << "'\n";
+            return 1;
+        }
+        Outputs.push_back(OutputSpec(Format, Extra.second, 0));
+    }
+
+    std::vector<MemoryRegion> Regions(MemoryRegions.size());
+    for (size_t i = 0, e = MemoryRegions.size(); i != e; ++i) {
+        if (!ParseRegion(MemoryRegions[i], Regions[i])) {
+            errs() << ToolName << ": invalid region '" << MemoryRegions[i] << "'\n";
+            return 1;
+        }
+        for (size_t r = 0; r != i; ++r) {
+            if (Regions[i].Begin < Regions[r].End && Regions[r].Begin < Regions[i].End) {
+                errs() << ToolName << ": region '" << MemoryRegions[i] << "' overlaps region '"
+                       << MemoryRegions[r] << "'\n";
+                return 1;
+            }
+        }
+        Outputs.push_back(OutputSpec(OutputTarget, Regions[i].Filename, i + 1));
+    }
+
+    if (!MemoryLimit.empty()) {
+        if (!ParseSize(MemoryLimit, MemoryBudget) || MemoryBudget == 0) {
+            errs() << ToolName << ": invalid --memory-limit '" << MemoryLimit << "'\n";
+            return 1;
+        }
+        if (!ApplyMemoryLimit(Outputs)) return 1;
+    }
+
+    if (InputTarget == binary_input) {
+        return WrapBinary(InputFilenames[0]) ? 0 : 1;
+    }
+
+    InputFiles Inputs;
+    if (!Inputs.open(InputFilenames)) {
+        return 1;
+    }
+    ElementsBigEndian = !Inputs.objects()[0]->isLittleEndian();
+
+    // Unless an output, --personalize or --delta-from goes over the sections
+    // again, what has been written can be dropped from memory.
+    if (MemoryBudget == 0) {
+        Mappings.setReleaseConsumed(Outputs.size() == 1 && PersonalizeCSV.empty() && DeltaFrom.empty());
+    }
+
+    if (!Inputs.archs().empty()) {
+        bool Success = ConvertSlices(Inputs.objects(), Inputs.archs(), Flash);
+        if (BufferStats) Buffers.printStats(errs());
+        return Success ? 0 : 1;
+    }
+
+    if (OutputTarget == elf) {
+        return CopyELF(Inputs.objects()[0]) ? 0 : 1;
+    }
+
+    std::vector<SectionData> Sections;
+    if (!PrepareSections(Inputs.objects(), Flash, Sections)) {
+        return 1;
+    }
+    if (MemoryBudget != 0) SplitMemoryBudget();
+
+    if (!FlashManifest.empty() && !Flash.writeManifest(Sections, FlashManifest)) {
+        return 1;
+    }
+
+    std::vector<std::vector<SectionData> > Lists;
+    SplitRegions(Sections, Regions, Lists);
+
+    bool Success = WriteOutputs(Lists, Outputs);
+
+    if (Success && !PersonalizeCSV.empty()) {
+        Success = Personalize(Inputs.objects(), Lists[0], PersonalizeCSV);
+    }
+
+    if (Success && !DeltaFrom.empty()) {
+        Success = WriteDeltaFrom(DeltaFrom, Flash, Regions, Lists[0]);
+    }
 
-    return 0;
+    if (BufferStats) Buffers.printStats(errs());
+    return Success ? 0 : 1;
 }
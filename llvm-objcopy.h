@@ -10,12 +10,150 @@
 #ifndef LLVM_OBJCOPY_H
 #define LLVM_OBJCOPY_H
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/DataTypes.h"
+#include <map>
+#include <vector>
+
 namespace llvm {
 
 class error_code;
+class MemoryBuffer;
+class raw_ostream;
+
+namespace object {
+class ObjectFile;
+}
 
 // Various helper functions.
 bool error(error_code ec);
+void writeZeros(raw_ostream &OS, uint64_t Count);
+
+// Write a delta from the flat image Old to New, and a manifest describing it
+// if ManifestFilename is not empty (Delta.cpp).
+bool writeDelta(StringRef Old, StringRef New, StringRef OutputFilename,
+                StringRef ManifestFilename);
+
+// New contents for a section, for --update-section.
+struct SectionUpdate {
+    StringRef Name;
+    StringRef Contents;
+};
+
+// Write Data as a relocatable ELF object for the architecture Arch, with
+// symbols named after InputName around it (BinaryELF.cpp).
+bool writeBinaryELF(StringRef Data, StringRef InputName, StringRef Arch,
+                    StringRef OutputFilename);
+
+// Compress Input into one LZ4 block, appended to Output.  Scratch holds the
+// hash table; passing the same string again saves allocating it each time
+// (Compress.cpp).
+void compressLZ4Block(StringRef Input, std::string &Output, std::string &Scratch);
+
+// Copy the ELF file o to OutputFilename, leaving out the non-allocated
+// sections for which ShouldRemove returns true and replacing the contents of
+// the sections in Updates.  If OutputFilename is the input file itself and
+// only updates that fit in place are requested, the file is patched instead
+// of rewritten (ELFCopy.cpp).
+bool copyELF(object::ObjectFile *o, StringRef OutputFilename,
+             bool (*ShouldRemove)(StringRef SectionName),
+             ArrayRef<SectionUpdate> Updates);
+
+// Finds the compressed sections of an object file: ELF sections with
+// SHF_COMPRESSED set and GNU-style .zdebug sections (Decompress.cpp).
+class SectionDecompressor {
+public:
+    struct Compressed {
+        unsigned  Type;     // ELFCOMPRESS_* value.
+        uint64_t  Size;     // Uncompressed size.
+        StringRef Stream;   // Compressed data, without the header.
+    };
+    typedef std::map<const char *, Compressed> SectionMap;
+
+    explicit SectionDecompressor(object::ObjectFile *o);
+
+    // Return true if the section Name, whose contents are Contents, is
+    // compressed, and describe it in Section.
+    bool isCompressed(StringRef Name, StringRef Contents, Compressed &Section) const;
+
+    // Inflate a section found by isCompressed.  Safe to call concurrently.
+    static bool decompress(StringRef Name, const Compressed &Section,
+                           OwningPtr<MemoryBuffer> &Result);
+
+private:
+    SectionMap mSections;   // SHF_COMPRESSED sections by contents.
+};
+
+// The section header table of an ELF file, read once into one array per
+// field, so that walking the sections costs no section_iterator calls
+// (SectionIndex.cpp).  Sections are numbered as in the file, 0 being the
+// null section.
+class ELFSectionIndex {
+public:
+    explicit ELFSectionIndex(object::ObjectFile *o);
+
+    // Return true if o is an ELF file whose section headers could be read.
+    bool isValid() const { return mValid; }
+
+    size_t    getNumSections() const { return mSizes.size(); }
+    StringRef getName(size_t i) const;
+    uint64_t  getAddress(size_t i) const { return mAddresses[i]; }
+    uint64_t  getSize(size_t i) const { return mSizes[i]; }
+    bool      isAllocated(size_t i) const { return mFlags[i] & Allocated; }
+    bool      isNoBits(size_t i) const { return mFlags[i] & NoBits; }
+
+    // Point Contents at the data of section i.  Returns false if it is not
+    // within the file.
+    bool getContents(size_t i, StringRef &Contents) const;
+
+private:
+    enum {
+        Allocated = 1,  // SHF_ALLOC
+        NoBits    = 2   // SHT_NOBITS
+    };
+
+    template <class ELFT> bool read(StringRef Data);
+
+    bool                    mValid;
+    StringRef               mData;
+    StringRef               mNames;
+    std::vector<uint32_t>   mNameOffsets;
+    std::vector<uint64_t>   mAddresses;
+    std::vector<uint64_t>   mSizes;
+    std::vector<uint64_t>   mOffsets;
+    std::vector<uint8_t>    mFlags;
+};
+
+// Where the sections of a PE image are loaded (PEImage.cpp).  Each section
+// is at ImageBase plus its RVA, and past the end of its raw data it is zeros
+// up to its VirtualSize.
+class PEImage {
+public:
+    struct Section {
+        uint64_t  Address;      // ImageBase + VirtualAddress.
+        uint64_t  Size;         // VirtualSize.
+        StringRef Contents;     // Raw data, no more than Size bytes of it.
+        bool      Discardable;  // IMAGE_SCN_MEM_DISCARDABLE.
+    };
+
+    explicit PEImage(object::ObjectFile *o);
+
+    // Return true if o is a PE image whose headers could be read.
+    bool isImage() const { return mIsImage; }
+
+    // The section at position Index in the section table, or NULL.
+    const Section *getSection(unsigned Index) const;
+
+    // Where the image is loaded; symbol addresses are relative to it.
+    uint64_t getImageBase() const { return mImageBase; }
+
+private:
+    bool                 mIsImage;
+    uint64_t             mImageBase;
+    std::vector<Section> mSections;
+};
 
 } // end namespace llvm
 